@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "bench.h"
+#include "front.h"
+#include "ground_truth.h"
+#include "qht.h"
+#include "qqhtd.h"
+#include "stash.h"
+#include "twochoice.h"
+
+/**
+ * False positive and false negative rates of a filter on a stream with known ground truth,
+ * as in the evaluation of the SAC'19 paper.
+ *
+ * Usage: accuracy [--filters=qht,qqhtd,twochoice,stash,front] [--stash-entries=256] [--hot-keys=4096] [--sizes=64K,256K,1M] [--buckets=1,2,4] [--fingerprints=1,3,8]
+ *                 [--events=4M] [--sample=0.05] [--workload=uniform] [--universe=2M] [--cpu=N] [--json]
+ *
+ * Sizes are in bytes. The events of the workload (see workload.h for its options) are streamed through the filter,
+ * and checked against the ground truth of ground_truth.h.
+ * bits_per_item is the memory of the filter divided by the (estimated) number of distinct keys streamed. The memory
+ * includes the stash of stash and the set of hot keys of front, whose cells get what is left of the size.
+ */
+
+int main(int argc, char** argv) {
+	Arguments arguments(argc, argv);
+	PinToCpu(std::stoi(arguments.Get("cpu", "-1")));
+
+	Report report(arguments.Has("json"));
+
+	for(auto memory_bytes: arguments.GetSizes("sizes", "64K,256K,1M")) {
+		for(auto n_buckets: arguments.GetSizes("buckets", "1,2,4")) {
+			for(auto fingerprint_size: arguments.GetSizes("fingerprints", "1,3,8")) {
+				for(auto& name: arguments.GetList("filters", "qht,qqhtd,twochoice,stash,front")) {
+					const uint64_t memory_bits = memory_bytes * 8;
+					Accuracy accuracy;
+
+					WorkloadOptions options(arguments, 2 << 20);
+					options.target_cells = std::max(uint64_t(1), memory_bits / (n_buckets * fingerprint_size));
+					Workload<Key16> workload(options);
+
+					if(name == "qht") {
+						QHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+						accuracy = MeasureAccuracy(filter, workload, arguments);
+					} else if(name == "qqhtd") {
+						QQHTDFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+						accuracy = MeasureAccuracy(filter, workload, arguments);
+					} else if(name == "twochoice") {
+						TwoChoiceQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+						accuracy = MeasureAccuracy(filter, workload, arguments);
+					} else if(name == "stash") {
+						// The stash is taken from the memory of the filter
+						auto n_entries = arguments.GetSize("stash-entries", 256);
+						if(OverflowStash::MemoryBits(n_entries) >= memory_bits) {
+							std::fprintf(stderr, "Skipping stash: %s entries do not fit in %s bytes\n", std::to_string(n_entries).c_str(), std::to_string(memory_bytes).c_str());
+							continue;
+						}
+						StashedQHTFilter<Key16> filter(memory_bits - OverflowStash::MemoryBits(n_entries), n_buckets, fingerprint_size, n_entries);
+						accuracy = MeasureAccuracy(filter, workload, arguments);
+					} else if(name == "front") {
+						// The set of hot keys is taken from the memory of the filter
+						auto n_hot_keys = arguments.GetSize("hot-keys", 4096);
+						if(HotKeySet::MemoryBits(n_hot_keys) >= memory_bits) {
+							std::fprintf(stderr, "Skipping front: %s hot keys do not fit in %s bytes\n", std::to_string(n_hot_keys).c_str(), std::to_string(memory_bytes).c_str());
+							continue;
+						}
+						FrontCachedFilter<Key16> filter(memory_bits - HotKeySet::MemoryBits(n_hot_keys), n_buckets, fingerprint_size, n_hot_keys);
+						accuracy = MeasureAccuracy(filter, workload, arguments);
+					} else {
+						std::fprintf(stderr, "Unknown filter %s\n", name.c_str());
+						continue;
+					}
+
+					Record record;
+					record.Add("filter", name)
+						.Add("memory_bytes", memory_bytes)
+						.Add("buckets", n_buckets)
+						.Add("fingerprint_bits", fingerprint_size)
+						.Add("distinct", accuracy.distinct)
+						.Add("bits_per_item", double(memory_bits) / double(std::max(accuracy.distinct, uint64_t(1))))
+						.Add("fpr", accuracy.FPR())
+						.Add("fnr", accuracy.FNR())
+						.Add("sampled_first", accuracy.first_occurrences)
+						.Add("sampled_duplicates", accuracy.duplicates);
+					report.Print(record);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
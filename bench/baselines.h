@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include "hash.h"
+#include "packed.h"
+
+/**
+ * Competitors of QHT for head-to-head benchmarks, with the same interface as QHTFilter:
+ * built from a memory budget in bits, Stream(e) returns true if e is detected as a duplicate and inserts it otherwise.
+ * All of them hash elements with Hash1 and Hash2, like QHTFilter.
+ *
+ *  - StableBloomFilter: the baseline of the SAC'19 paper (Deng & Rafiei, SIGMOD'06)
+ *  - BlockedBloomFilter: Bloom filter whose k bits are in a single cache line, never evicts
+ *  - CuckooFilter: 4 fingerprints per bucket, 2 candidate buckets, drops a victim when full
+ *  - HashSetFilter: open addressing over 64-bit hashes, 8 slots per cache line, random eviction when full
+ *  - ExactFilter: std::unordered_set of the elements, ignores the memory budget (reference point)
+ */
+
+template <class T> struct StableBloomFilter {
+	/**
+	 * m cells of d bits. Stream(e) reports a duplicate if the k cells of e are all nonzero, then decrements
+	 * P consecutive cells from a random position and sets the k cells of e to Max = 2^d - 1.
+	 * P is derived from the target stable false positive rate, following the analysis of the original paper.
+	 */
+	size_t n_cells;
+	size_t cell_size;
+	size_t n_hashes;
+	size_t n_decrements;
+	uint64_t max_value;
+
+	std::mt19937_64 rng;
+	PackedBits cells;
+
+	StableBloomFilter(const uint64_t memory_size, const size_t n_cell_size = 2, const size_t n_n_hashes = 3, const double target_fpr = 0.01)
+		: n_cells(memory_size / n_cell_size), cell_size(n_cell_size), n_hashes(n_n_hashes), n_decrements(1),
+		  max_value((uint64_t(1) << n_cell_size) - 1), rng(), cells(PackedWords(memory_size)) {
+		// Stable proportion of zero cells p0 = (1 / (1 + 1 / (P (1/k - 1/m))))^Max and FPR = (1 - p0)^k
+		auto zeros = 1. - std::pow(target_fpr, 1. / double(n_hashes));
+		auto c = 1. / double(n_hashes) - 1. / double(n_cells);
+		n_decrements = std::max(size_t(1), size_t(std::lround(1. / (c * (std::pow(zeros, -1. / double(max_value)) - 1.)))));
+	}
+
+	uint64_t Get(const size_t cell) const { return ReadBits(cells.data(), cell * cell_size, cell_size); }
+	void Set(const size_t cell, const uint64_t value) { WriteBits(cells.data(), cell * cell_size, cell_size, value); }
+
+	bool Lookup(const T& e) const {
+		uint64_t h1 = Hash1(e), h2 = Hash2(e) | 1;
+		for(size_t i = 0; i < n_hashes; ++i) {
+			if(Get((h1 + i * h2) % n_cells) == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool Stream(const T& e) {
+		auto detected = Lookup(e);
+
+		auto start = std::uniform_int_distribution<size_t>(0, n_cells - 1)(rng);
+		for(size_t i = 0; i < n_decrements; ++i) {
+			auto cell = (start + i) % n_cells;
+			auto value = Get(cell);
+			if(value != 0) {
+				Set(cell, value - 1);
+			}
+		}
+
+		uint64_t h1 = Hash1(e), h2 = Hash2(e) | 1;
+		for(size_t i = 0; i < n_hashes; ++i) {
+			Set((h1 + i * h2) % n_cells, max_value);
+		}
+
+		return detected;
+	}
+};
+
+template <class T> struct BlockedBloomFilter {
+	/** Bloom filter split in blocks of 512 bits: Hash1 selects the block, Hash2 the k bits inside it (double hashing) */
+	size_t n_blocks;
+	size_t n_hashes;
+	std::vector<uint64_t> blocks;
+
+	BlockedBloomFilter(const uint64_t memory_size, const size_t n_n_hashes = 6)
+		: n_blocks(std::max(uint64_t(1), memory_size / 512)), n_hashes(n_n_hashes), blocks(8 * n_blocks, 0) {
+	}
+
+	bool Stream(const T& e) {
+		auto block = blocks.data() + 8 * (Hash1(e) % n_blocks);
+		uint64_t h2 = Hash2(e);
+		uint64_t step = (h2 >> 9) | 1;
+
+		bool detected = true;
+		for(size_t i = 0; i < n_hashes; ++i) {
+			auto bit = (h2 + i * step) & 511;
+			auto mask = uint64_t(1) << (bit & 63);
+			detected &= (block[bit >> 6] & mask) != 0;
+			block[bit >> 6] |= mask;
+		}
+
+		return detected;
+	}
+};
+
+template <class T> struct CuckooFilter {
+	/**
+	 * Fan et al. (CoNEXT'14): buckets of 4 fingerprints, a power-of-two number of buckets,
+	 * partial-key cuckoo hashing (i2 = i1 ^ hash(fingerprint)). When an insertion fails after
+	 * max_kicks relocations, the last victim is dropped, which is how the filter forgets in a stream.
+	 * Once the filter is full, every new element pays max_kicks relocations.
+	 */
+	static const size_t kSlots = 4;
+
+	size_t fingerprint_size;
+	size_t max_kicks;
+	size_t n_buckets;
+	std::mt19937_64 rng;
+	PackedBits slots;
+
+	CuckooFilter(const uint64_t memory_size, const size_t n_fingerprint_size = 12, const size_t n_max_kicks = 500)
+		: fingerprint_size(n_fingerprint_size), max_kicks(n_max_kicks), n_buckets(1), rng(), slots() {
+		while(2 * n_buckets * kSlots * fingerprint_size <= memory_size) {
+			n_buckets *= 2;
+		}
+		slots.assign(PackedWords(n_buckets * kSlots * fingerprint_size), 0);
+	}
+
+	uint64_t Get(const size_t bucket, const size_t slot) const {
+		return ReadBits(slots.data(), (bucket * kSlots + slot) * fingerprint_size, fingerprint_size);
+	}
+
+	void Set(const size_t bucket, const size_t slot, const uint64_t value) {
+		WriteBits(slots.data(), (bucket * kSlots + slot) * fingerprint_size, fingerprint_size, value);
+	}
+
+	size_t AltBucket(const size_t bucket, const uint64_t fingerprint) const {
+		return (bucket ^ (fingerprint * 0x5bd1e995)) & (n_buckets - 1);
+	}
+
+	bool InBucket(const size_t bucket, const uint64_t fingerprint) const {
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			if(Get(bucket, slot) == fingerprint) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool InsertInBucket(const size_t bucket, const uint64_t fingerprint) {
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			if(Get(bucket, slot) == 0) {
+				Set(bucket, slot, fingerprint);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Stream(const T& e) {
+		uint64_t fingerprint = Hash2(e) & ((uint64_t(1) << fingerprint_size) - 1);
+		fingerprint += fingerprint == 0;
+
+		auto bucket = Hash1(e) & (n_buckets - 1);
+		auto alt_bucket = AltBucket(bucket, fingerprint);
+
+		if(InBucket(bucket, fingerprint) || InBucket(alt_bucket, fingerprint)) {
+			return true;
+		}
+
+		if(InsertInBucket(bucket, fingerprint) || InsertInBucket(alt_bucket, fingerprint)) {
+			return false;
+		}
+
+		// Both buckets are full: kick fingerprints around, and drop the last victim if no room is found
+		bucket = rng() & 1 ? bucket : alt_bucket;
+		for(size_t kick = 0; kick < max_kicks; ++kick) {
+			auto slot = rng() % kSlots;
+			auto victim = Get(bucket, slot);
+			Set(bucket, slot, fingerprint);
+
+			fingerprint = victim;
+			bucket = AltBucket(bucket, fingerprint);
+			if(InsertInBucket(bucket, fingerprint)) {
+				break;
+			}
+		}
+
+		return false;
+	}
+};
+
+template <class T> struct HashSetFilter {
+	/**
+	 * Open addressing set of 64-bit hashes, grouped by 8 (one cache line) so that probing stays in one line.
+	 * An element is a duplicate if its hash is in its group, otherwise it goes to an empty slot of the group
+	 * or replaces a random one. 0 marks empty slots.
+	 */
+	static const size_t kSlots = 8;
+
+	size_t n_groups;
+	std::mt19937_64 rng;
+	std::vector<uint64_t> slots;
+
+	explicit HashSetFilter(const uint64_t memory_size)
+		: n_groups(std::max(uint64_t(1), memory_size / (64 * kSlots))), rng(), slots(kSlots * n_groups, 0) {
+	}
+
+	bool Stream(const T& e) {
+		uint64_t hash = Hash1(e);
+		hash += hash == 0;
+
+		auto group = slots.data() + kSlots * (Hash2(e) % n_groups);
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			if(group[slot] == hash) {
+				return true;
+			}
+			if(group[slot] == 0) {
+				group[slot] = hash;
+				return false;
+			}
+		}
+
+		group[rng() % kSlots] = hash;
+		return false;
+	}
+};
+
+template <class T> struct ExactFilter {
+	/** Exact duplicate detection, for reference: memory grows with the number of distinct elements */
+	struct Hasher {
+		size_t operator()(const T& e) const { return Hash1(e); }
+	};
+
+	std::unordered_set<T, Hasher> elements;
+
+	explicit ExactFilter(const uint64_t) : elements() {}
+
+	bool Stream(const T& e) {
+		return !elements.insert(e).second;
+	}
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/**
+ * Shared helpers of the benchmark executables: command line, timing, CPU pinning and output.
+ */
+
+template <class T> inline void DoNotOptimize(const T& value) {
+	/** Prevents the compiler from optimizing away the computation of value */
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Timer {
+	std::chrono::steady_clock::time_point start;
+
+	Timer() : start(std::chrono::steady_clock::now()) {}
+
+	double Seconds() const {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+inline int PinToCpu(int cpu) {
+	/**
+	 * Pins the calling thread to a CPU, so that measurements do not suffer from migrations
+	 * @param cpu: CPU to run on, or -1 for the first CPU the process is allowed to run on
+	 * @returns the CPU the thread is pinned to, -1 if pinning failed or is not supported
+	 */
+#ifdef __linux__
+	cpu_set_t set;
+	if(cpu < 0) {
+		if(sched_getaffinity(0, sizeof(set), &set) != 0) {
+			return -1;
+		}
+		for(int i = 0; i < CPU_SETSIZE && cpu < 0; ++i) {
+			if(CPU_ISSET(i, &set)) {
+				cpu = i;
+			}
+		}
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0 ? cpu : -1;
+#else
+	(void) cpu;
+	return -1;
+#endif
+}
+
+struct Arguments {
+	/**
+	 * Command line of the form --name=value or --flag
+	 * Lists are comma-separated, sizes accept K, M and G suffixes (powers of 1024).
+	 */
+	std::map<std::string, std::string> values;
+
+	Arguments(int argc, char** argv) : values() {
+		for(int i = 1; i < argc; ++i) {
+			std::string argument = argv[i];
+			if(argument.compare(0, 2, "--") != 0) {
+				std::fprintf(stderr, "Ignoring argument %s\n", argv[i]);
+				continue;
+			}
+
+			auto equal = argument.find('=');
+			if(equal == std::string::npos) {
+				values[argument.substr(2)] = "1";
+			} else {
+				values[argument.substr(2, equal - 2)] = argument.substr(equal + 1);
+			}
+		}
+	}
+
+	bool Has(const std::string& name) const {
+		return values.count(name) != 0;
+	}
+
+	std::string Get(const std::string& name, const std::string& fallback) const {
+		auto value = values.find(name);
+		return value == values.end() ? fallback : value->second;
+	}
+
+	static uint64_t ParseSize(const std::string& text) {
+		char* end = nullptr;
+		uint64_t value = std::strtoull(text.c_str(), &end, 10);
+
+		switch(*end) {
+		case 'G': case 'g': value <<= 10; // fall through
+		case 'M': case 'm': value <<= 10; // fall through
+		case 'K': case 'k': value <<= 10; break;
+		default: break;
+		}
+
+		return value;
+	}
+
+	uint64_t GetSize(const std::string& name, const uint64_t fallback) const {
+		return Has(name) ? ParseSize(Get(name, "")) : fallback;
+	}
+
+	std::vector<std::string> GetList(const std::string& name, const std::string& fallback) const {
+		std::vector<std::string> list;
+		std::stringstream stream(Get(name, fallback));
+		std::string item;
+		while(std::getline(stream, item, ',')) {
+			if(!item.empty()) {
+				list.push_back(item);
+			}
+		}
+		return list;
+	}
+
+	std::vector<uint64_t> GetSizes(const std::string& name, const std::string& fallback) const {
+		std::vector<uint64_t> sizes;
+		for(auto& item: GetList(name, fallback)) {
+			sizes.push_back(ParseSize(item));
+		}
+		return sizes;
+	}
+};
+
+struct Record {
+	/** One line of results: an ordered list of named fields, printed as a JSON object or as text */
+	std::vector<std::pair<std::string, std::string>> fields;
+	std::vector<bool> quoted;
+
+	Record() : fields(), quoted() {}
+
+	Record& Add(const std::string& name, const std::string& value) {
+		fields.emplace_back(name, value);
+		quoted.push_back(true);
+		return *this;
+	}
+
+	Record& Add(const std::string& name, const char* value) {
+		return Add(name, std::string(value));
+	}
+
+	template <class Number> Record& Add(const std::string& name, const Number value) {
+		std::ostringstream text;
+		text << value;
+		fields.emplace_back(name, text.str());
+		quoted.push_back(false);
+		return *this;
+	}
+
+	std::string Json() const {
+		std::string json = "{";
+		for(size_t i = 0; i < fields.size(); ++i) {
+			json += (i == 0 ? "\"" : ", \"") + fields[i].first + "\": ";
+			json += quoted[i] ? "\"" + fields[i].second + "\"" : fields[i].second;
+		}
+		return json + "}";
+	}
+
+	std::string Text() const {
+		std::string text;
+		for(size_t i = 0; i < fields.size(); ++i) {
+			text += (i == 0 ? "" : " ") + fields[i].first + "=" + fields[i].second;
+		}
+		return text;
+	}
+};
+
+struct Report {
+	/** Prints records as they come, either as text lines or as a JSON array */
+	bool json;
+	size_t n_records;
+
+	explicit Report(const bool n_json) : json(n_json), n_records(0) {
+		if(json) {
+			std::printf("[\n");
+		}
+	}
+
+	~Report() {
+		if(json) {
+			std::printf("\n]\n");
+		}
+	}
+
+	Report(const Report&) = delete;
+	Report& operator=(const Report&) = delete;
+
+	void Print(const Record& record) {
+		if(json) {
+			std::printf("%s  %s", n_records == 0 ? "" : ",\n", record.Json().c_str());
+		} else {
+			std::printf("%s\n", record.Text().c_str());
+		}
+		std::fflush(stdout);
+		++n_records;
+	}
+};
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "baselines.h"
+#include "bench.h"
+#include "front.h"
+#include "ground_truth.h"
+#include "perf.h"
+#include "qht.h"
+#include "qqhtd.h"
+#include "stash.h"
+#include "twochoice.h"
+
+/**
+ * Head-to-head comparison of QHT with other duplicate detection structures (see baselines.h),
+ * under the same workload and the same memory budget: throughput and accuracy.
+ *
+ * Usage: compare [--filters=qht,qqhtd,twochoice,stash,front,sbf,bloom,cuckoo,hashset,exact] [--sizes=64K,1M,16M]
+ *                [--buckets=3] [--fingerprint=5] [--stash-entries=256] [--hot-keys=4096] [--sbf-bits=2] [--sbf-hashes=3] [--sbf-fpr=0.01]
+ *                [--bloom-hashes=6] [--cuckoo-fingerprint=12] [--cuckoo-kicks=500]
+ *                [--events=4M] [--sample=0.05] [--workload=uniform] [--universe=2M] [--perf=1] [--cpu=N] [--json]
+ *
+ * Sizes are in bytes, see workload.h for the options of the workload. For each filter, a first run streams the events and measures the time per Stream,
+ * a second run on a fresh filter measures the false positive and false negative rates (see ground_truth.h).
+ * Hardware counters per Stream of the first run are added when available (see perf.h).
+ * The stash of stash and the set of hot keys of front are part of the memory budget: their cells get what is left.
+ */
+
+template <class Filter, class Factory> void Run(Report& report, const Arguments& arguments, PerfCounters& perf, const WorkloadOptions& options,
+	const std::string& name, const uint64_t memory_bytes, Factory make_filter) {
+
+	const uint64_t n_events = arguments.GetSize("events", 4 << 20);
+
+	auto keys = Workload<Key16>(options).Generate(n_events);
+
+	double seconds;
+	{
+		Filter filter = make_filter();
+		perf.Start();
+		Timer timer;
+		size_t detected = 0;
+		for(auto& key: keys) {
+			detected += filter.Stream(key);
+		}
+		DoNotOptimize(detected);
+		seconds = timer.Seconds();
+		perf.Stop();
+	}
+
+	Filter filter = make_filter();
+	Workload<Key16> workload(options);
+	auto accuracy = MeasureAccuracy(filter, workload, arguments);
+
+	Record record;
+	record.Add("filter", name)
+		.Add("memory_bytes", memory_bytes)
+		.Add("ops_per_s", double(keys.size()) / seconds)
+		.Add("ns_per_op", seconds * 1e9 / double(keys.size()))
+		.Add("bits_per_item", double(8 * memory_bytes) / double(std::max(accuracy.distinct, uint64_t(1))))
+		.Add("fpr", accuracy.FPR())
+		.Add("fnr", accuracy.FNR());
+	perf.AddTo(record, keys.size());
+	report.Print(record);
+}
+
+int main(int argc, char** argv) {
+	Arguments arguments(argc, argv);
+	PinToCpu(std::stoi(arguments.Get("cpu", "-1")));
+
+	PerfCounters perf(arguments.Get("perf", "1") != "0");
+	WarnIfUnavailable(perf, arguments.Get("perf", "1") != "0");
+
+	Report report(arguments.Has("json"));
+
+	const size_t n_buckets = arguments.GetSize("buckets", 3);
+	const size_t fingerprint_size = arguments.GetSize("fingerprint", 5);
+
+	for(auto memory_bytes: arguments.GetSizes("sizes", "64K,1M,16M")) {
+		const uint64_t bits = 8 * memory_bytes;
+
+		// Adversarial workloads target the cells of QHT
+		WorkloadOptions options(arguments, 2 << 20);
+		options.target_cells = std::max(uint64_t(1), bits / (n_buckets * fingerprint_size));
+
+		for(auto& name: arguments.GetList("filters", "qht,qqhtd,twochoice,stash,front,sbf,bloom,cuckoo,hashset,exact")) {
+			if(name == "qht") {
+				Run<QHTFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return QHTFilter<Key16>(bits, n_buckets, fingerprint_size);
+				});
+			} else if(name == "qqhtd") {
+				Run<QQHTDFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return QQHTDFilter<Key16>(bits, n_buckets, fingerprint_size);
+				});
+			} else if(name == "twochoice") {
+				Run<TwoChoiceQHTFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return TwoChoiceQHTFilter<Key16>(bits, n_buckets, fingerprint_size);
+				});
+			} else if(name == "stash") {
+				// The stash is taken from the memory of the filter
+				auto n_entries = arguments.GetSize("stash-entries", 256);
+				if(OverflowStash::MemoryBits(n_entries) >= bits) {
+					std::fprintf(stderr, "Skipping stash: %s entries do not fit in %s bytes\n", std::to_string(n_entries).c_str(), std::to_string(memory_bytes).c_str());
+					continue;
+				}
+				Run<StashedQHTFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return StashedQHTFilter<Key16>(bits - OverflowStash::MemoryBits(n_entries), n_buckets, fingerprint_size, n_entries);
+				});
+			} else if(name == "front") {
+				// The set of hot keys is taken from the memory of the filter
+				auto n_hot_keys = arguments.GetSize("hot-keys", 4096);
+				if(HotKeySet::MemoryBits(n_hot_keys) >= bits) {
+					std::fprintf(stderr, "Skipping front: %s hot keys do not fit in %s bytes\n", std::to_string(n_hot_keys).c_str(), std::to_string(memory_bytes).c_str());
+					continue;
+				}
+				Run<FrontCachedFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return FrontCachedFilter<Key16>(bits - HotKeySet::MemoryBits(n_hot_keys), n_buckets, fingerprint_size, n_hot_keys);
+				});
+			} else if(name == "sbf") {
+				Run<StableBloomFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return StableBloomFilter<Key16>(bits, arguments.GetSize("sbf-bits", 2), arguments.GetSize("sbf-hashes", 3),
+						std::stod(arguments.Get("sbf-fpr", "0.01")));
+				});
+			} else if(name == "bloom") {
+				Run<BlockedBloomFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return BlockedBloomFilter<Key16>(bits, arguments.GetSize("bloom-hashes", 6));
+				});
+			} else if(name == "cuckoo") {
+				Run<CuckooFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return CuckooFilter<Key16>(bits, arguments.GetSize("cuckoo-fingerprint", 12), arguments.GetSize("cuckoo-kicks", 500));
+				});
+			} else if(name == "hashset") {
+				Run<HashSetFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return HashSetFilter<Key16>(bits);
+				});
+			} else if(name == "exact") {
+				Run<ExactFilter<Key16>>(report, arguments, perf, options, name, memory_bytes, [&]() {
+					return ExactFilter<Key16>(bits);
+				});
+			} else {
+				std::fprintf(stderr, "Unknown filter %s\n", name.c_str());
+			}
+		}
+	}
+
+	return 0;
+}
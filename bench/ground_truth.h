@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <unordered_set>
+
+#include "bench.h"
+#include "workload.h"
+
+/**
+ * Accuracy of a filter on a key stream (see workload.h), shared by the accuracy benchmarks.
+ *
+ * Ground truth is kept in an exact set of ids, but only for the ids selected by hash-based sampling
+ * (a fraction `sample` of them), which bounds its memory:
+ *  - a false positive is a first occurrence of a sampled key that the filter reports as a duplicate,
+ *  - a false negative is a repeated occurrence of a sampled key that the filter reports as new.
+ *
+ * Options: [--events=4M] [--sample=0.05], plus the options of the workload
+ */
+
+struct Accuracy {
+	/** Outcome of the sampled events */
+	uint64_t first_occurrences = 0;
+	uint64_t duplicates = 0;
+	uint64_t false_positives = 0;
+	uint64_t false_negatives = 0;
+	uint64_t distinct = 0;
+
+	double FPR() const { return first_occurrences == 0 ? 0. : double(false_positives) / double(first_occurrences); }
+	double FNR() const { return duplicates == 0 ? 0. : double(false_negatives) / double(duplicates); }
+};
+
+template <class Filter> Accuracy MeasureAccuracy(Filter& filter, Workload<Key16>& workload, const Arguments& arguments) {
+	/** Streams the events of the workload through the filter and checks the answers for the sampled keys */
+	const uint64_t n_events = arguments.GetSize("events", 4 << 20);
+	const double sample = std::stod(arguments.Get("sample", "0.05"));
+	const uint64_t sample_threshold = sample >= 1 ? ~uint64_t(0) : uint64_t(sample * 18446744073709551616.);
+
+	std::unordered_set<uint64_t> seen;
+
+	Accuracy accuracy;
+	Key16 key;
+	uint64_t id;
+	for(uint64_t event = 0; event < n_events && workload.Next(key, id); ++event) {
+		auto detected = filter.Stream(key);
+
+		if(Mix(id ^ 0xa5a5a5a5a5a5a5a5) > sample_threshold) {
+			continue;
+		}
+
+		if(seen.insert(id).second) {
+			++accuracy.first_occurrences;
+			accuracy.false_positives += detected;
+		} else {
+			++accuracy.duplicates;
+			accuracy.false_negatives += !detected;
+		}
+	}
+
+	accuracy.distinct = uint64_t(double(seen.size()) / std::min(sample, 1.));
+	return accuracy;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Latency measurement helpers: a cycle counter and an HDR-style histogram.
+ */
+
+inline uint64_t CyclesBegin() {
+	/** Timestamp before a measured operation: earlier instructions complete before the counter is read */
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_lfence();
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline uint64_t CyclesEnd() {
+	/** Timestamp after a measured operation: the counter is read once the operation completed */
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int cpu;
+	auto cycles = __rdtscp(&cpu);
+	_mm_lfence();
+	return cycles;
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline double CyclesPerNanosecond() {
+	/** Frequency of the counter of CyclesBegin/CyclesEnd, calibrated against steady_clock over ~20 ms */
+	auto start = std::chrono::steady_clock::now();
+	auto start_cycles = CyclesBegin();
+	while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(20)) {
+	}
+	auto end_cycles = CyclesEnd();
+	auto nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return double(end_cycles - start_cycles) / nanoseconds;
+}
+
+class Histogram {
+	/**
+	 * Log-linear histogram of 64-bit values, in the spirit of HdrHistogram: values below 2^kSubBits are counted exactly,
+	 * larger values in buckets of relative width at most 2^-(kSubBits - 1) (< 1% with kSubBits = 8).
+	 * Recording is constant time and the memory is fixed (~120 KB), whatever the range of the values.
+	 */
+	static const int kSubBits = 8;
+	static const uint64_t kSubBuckets = uint64_t(1) << kSubBits;
+
+	std::vector<uint64_t> counts;
+	uint64_t total;
+	uint64_t max;
+
+	static size_t Index(const uint64_t value) {
+		if(value < kSubBuckets) {
+			return size_t(value);
+		}
+		int shift = 63 - __builtin_clzll(value) - kSubBits + 1;
+		return size_t(shift) * kSubBuckets + size_t(value >> shift);
+	}
+
+	static uint64_t HighestValue(const size_t index) {
+		/** @returns the largest value counted at index */
+		auto shift = index / kSubBuckets;
+		auto sub = index % kSubBuckets;
+		return ((uint64_t(sub) + 1) << shift) - 1;
+	}
+
+public:
+	Histogram() : counts((64 - kSubBits + 1) * kSubBuckets, 0), total(0), max(0) {}
+
+	void Record(const uint64_t value) {
+		++counts[Index(value)];
+		++total;
+		max = std::max(max, value);
+	}
+
+	uint64_t Count() const { return total; }
+	uint64_t Max() const { return max; }
+
+	uint64_t Percentile(const double percentile) const {
+		/** @returns an upper bound (within the precision of the histogram) of the given percentile of the values, in [0, 100] */
+		if(total == 0) {
+			return 0;
+		}
+
+		auto rank = std::max(uint64_t(1), uint64_t(std::ceil(percentile / 100. * double(total))));
+		uint64_t seen = 0;
+		for(size_t i = 0; i < counts.size(); ++i) {
+			seen += counts[i];
+			if(seen >= rank) {
+				return std::min(HighestValue(i), max);
+			}
+		}
+		return max;
+	}
+};
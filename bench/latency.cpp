@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "bench.h"
+#include "histogram.h"
+#include "perf.h"
+#include "qht.h"
+#include "qqhtd.h"
+#include "rqht.h"
+#include "workload.h"
+
+/**
+ * Tail latency of Stream: p50, p99, p99.9 and max, for each filter (storage backend) and configuration.
+ *
+ * Usage: latency [--filters=qht,qqhtd,rqht] [--sizes=32K,8M,256M] [--buckets=1,3] [--fingerprints=3,8]
+ *                [--quotient=2] [--ops=4M] [--every=8] [--reset-every=0] [--max-keys=4M] [--workload=uniform]
+ *                [--perf=1] [--cpu=N] [--json]
+ *
+ * Sizes are in bytes. A pool of keys (as many as the filter holds, at most max-keys, see workload.h) is streamed once
+ * as a warmup, then `ops` Streams run over the pool and one in `every` is timed with the cycle counter into a histogram.
+ * With reset-every > 0, the filter is Reset every reset-every Streams, inside a timed operation: its cost lands
+ * in the tail of the Stream that triggers it, as it would in production. Latencies are reported in nanoseconds.
+ * Unless --perf=0, hardware counters per Stream of the measured run (timed and untimed Streams) are added when
+ * available (see perf.h).
+ */
+
+template <class Filter, class Key> void Run(Report& report, const Arguments& arguments, PerfCounters& perf, Record configuration, Filter& filter,
+	const size_t n_cells, const size_t n_buckets, const double cycles_per_ns) {
+
+	const uint64_t n_ops = arguments.GetSize("ops", 4 << 20);
+	const uint64_t every = std::max(uint64_t(1), arguments.GetSize("every", 8));
+	const uint64_t reset_every = arguments.GetSize("reset-every", 0);
+
+	WorkloadOptions options(arguments, uint64_t(1) << 62);
+	options.target_cells = std::max(size_t(1), n_cells);
+	auto n_keys = std::max(size_t(1), std::min(n_cells * n_buckets, size_t(arguments.GetSize("max-keys", 4 << 20))));
+	auto keys = Workload<Key>(options).Generate(n_keys);
+	if(keys.empty()) {
+		return;
+	}
+
+	size_t detected = 0;
+	for(auto& key: keys) {
+		detected += filter.Stream(key);
+	}
+
+	Histogram histogram;
+	perf.Start();
+	for(uint64_t i = 0; i < n_ops; ++i) {
+		auto& key = keys[i % keys.size()];
+		auto reset = reset_every != 0 && (i + 1) % reset_every == 0;
+
+		if(i % every != 0 && !reset) {
+			detected += filter.Stream(key);
+			continue;
+		}
+
+		auto start = CyclesBegin();
+		if(reset) {
+			filter.Reset();
+		}
+		detected += filter.Stream(key);
+		histogram.Record(CyclesEnd() - start);
+	}
+	perf.Stop();
+	DoNotOptimize(detected);
+
+	auto ns = [&](const uint64_t cycles) { return double(cycles) / cycles_per_ns; };
+	configuration.Add("op", "stream")
+		.Add("samples", histogram.Count())
+		.Add("p50_ns", ns(histogram.Percentile(50)))
+		.Add("p99_ns", ns(histogram.Percentile(99)))
+		.Add("p999_ns", ns(histogram.Percentile(99.9)))
+		.Add("max_ns", ns(histogram.Max()));
+	perf.AddTo(configuration, n_ops);
+	report.Print(configuration);
+}
+
+int main(int argc, char** argv) {
+	Arguments arguments(argc, argv);
+
+	auto cpu = PinToCpu(std::stoi(arguments.Get("cpu", "-1")));
+	if(cpu < 0) {
+		std::fprintf(stderr, "Could not pin the benchmark to a CPU\n");
+	}
+
+	PerfCounters perf(arguments.Get("perf", "1") != "0");
+	WarnIfUnavailable(perf, arguments.Get("perf", "1") != "0");
+
+	const double cycles_per_ns = CyclesPerNanosecond();
+	const size_t quotient_size = arguments.GetSize("quotient", 2);
+
+	Report report(arguments.Has("json"));
+
+	for(auto memory_bytes: arguments.GetSizes("sizes", "32K,8M,256M")) {
+		for(auto n_buckets: arguments.GetSizes("buckets", "1,3")) {
+			for(auto fingerprint_size: arguments.GetSizes("fingerprints", "3,8")) {
+				for(auto& name: arguments.GetList("filters", "qht,qqhtd,rqht")) {
+					const uint64_t memory_bits = memory_bytes * 8;
+
+					Record configuration;
+					configuration.Add("filter", name)
+						.Add("memory_bytes", memory_bytes)
+						.Add("buckets", n_buckets)
+						.Add("fingerprint_bits", fingerprint_size)
+						.Add("reset_every", arguments.GetSize("reset-every", 0))
+						.Add("cpu", cpu);
+
+					if(name == "qht") {
+						QHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+						Run<QHTFilter<Key16>, Key16>(report, arguments, perf, configuration, filter, memory_bits / (n_buckets * fingerprint_size), n_buckets, cycles_per_ns);
+					} else if(name == "qqhtd") {
+						QQHTDFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+						Run<QQHTDFilter<Key16>, Key16>(report, arguments, perf, configuration, filter, memory_bits / (n_buckets * fingerprint_size), n_buckets, cycles_per_ns);
+					} else if(name == "rqht") {
+						RQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size, quotient_size);
+						Run<RQHTFilter<Key16>, Key16>(report, arguments, perf, configuration, filter, filter.Cells(), n_buckets, cycles_per_ns);
+					} else {
+						std::fprintf(stderr, "Unknown filter %s\n", name.c_str());
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "bench.h"
+
+/**
+ * Hardware performance counters of the calling thread, read with perf_event_open (Linux only):
+ * cycles, instructions, LLC misses, dTLB load misses and branch mispredictions.
+ *
+ * Counters are opened one by one, so that a counter the CPU (or a virtual machine) does not provide is skipped
+ * while the others still work. Only user space is counted, which perf_event_paranoid <= 2 allows without privileges.
+ * Counts are scaled by time_enabled / time_running when the kernel multiplexes the counters.
+ */
+
+/** Counts of the counters that could be opened, by name */
+typedef std::vector<std::pair<std::string, double>> PerfCounts;
+
+class PerfCounters {
+	struct Counter {
+		std::string name;
+		int fd;
+	};
+
+	std::vector<Counter> counters;
+
+#ifdef __linux__
+	void Open(const char* name, const uint32_t type, const uint64_t config) {
+		perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = type;
+		attributes.config = config;
+		attributes.disabled = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int fd = int(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+		if(fd >= 0) {
+			counters.push_back({name, fd});
+		}
+	}
+#endif
+
+public:
+	explicit PerfCounters(const bool enabled = true) : counters() {
+#ifdef __linux__
+		if(!enabled) {
+			return;
+		}
+
+		auto cache_event = [](const uint64_t cache, const uint64_t operation, const uint64_t result) {
+			return cache | (operation << 8) | (result << 16);
+		};
+
+		Open("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		Open("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		Open("llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		Open("dtlb_misses", PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+		Open("branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#else
+		(void) enabled;
+#endif
+	}
+
+	~PerfCounters() {
+#ifdef __linux__
+		for(auto& counter: counters) {
+			close(counter.fd);
+		}
+#endif
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool Available() const { return !counters.empty(); }
+
+	void Start() {
+#ifdef __linux__
+		for(auto& counter: counters) {
+			ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+
+	void Stop() {
+#ifdef __linux__
+		for(auto& counter: counters) {
+			ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+		}
+#endif
+	}
+
+	PerfCounts Read() const {
+		/** @returns the counts since the last Start, for the counters that could be opened */
+		PerfCounts counts;
+#ifdef __linux__
+		for(auto& counter: counters) {
+			uint64_t values[3] = {0, 0, 0}; // value, time enabled, time running
+			if(read(counter.fd, values, sizeof(values)) != ssize_t(sizeof(values))) {
+				continue;
+			}
+			auto scale = values[2] == 0 ? 0. : double(values[1]) / double(values[2]);
+			counts.emplace_back(counter.name, double(values[0]) * scale);
+		}
+#endif
+		return counts;
+	}
+
+	void AddTo(Record& record, const uint64_t n_ops) const { AddCounts(record, Read(), n_ops); }
+
+	static void AddCounts(Record& record, const PerfCounts& counts, const uint64_t n_ops) {
+		/** Adds <counter>_per_op fields to the record, and instructions per cycle if both are available */
+		double cycles = 0, instructions = 0;
+		for(auto& count: counts) {
+			record.Add(count.first + "_per_op", count.second / double(std::max(n_ops, uint64_t(1))));
+			cycles = count.first == "cycles" ? count.second : cycles;
+			instructions = count.first == "instructions" ? count.second : instructions;
+		}
+		if(cycles > 0 && instructions > 0) {
+			record.Add("ipc", instructions / cycles);
+		}
+	}
+};
+
+inline void Accumulate(PerfCounts& total, const PerfCounts& counts) {
+	/** Adds counts (e.g. of another thread) to total, counter by counter */
+	for(auto& count: counts) {
+		auto same = std::find_if(total.begin(), total.end(), [&](const std::pair<std::string, double>& other) { return other.first == count.first; });
+		if(same == total.end()) {
+			total.push_back(count);
+		} else {
+			same->second += count.second;
+		}
+	}
+}
+
+inline void WarnIfUnavailable(const PerfCounters& perf, const bool requested) {
+	if(requested && !perf.Available()) {
+		std::fprintf(stderr, "Hardware performance counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+	}
+}
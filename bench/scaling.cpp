@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "concurrent.h"
+#include "perf.h"
+#include "workload.h"
+
+/**
+ * Multi-thread scaling of Stream on a filter shared by 1..N threads (see concurrent.h).
+ *
+ * Usage: scaling [--modes=lockfree,sharded,partitioned,tiered] [--threads=1,2,4,8] [--workloads=uniform,zipf]
+ *                [--size=256M] [--buckets=3] [--fingerprint=5] [--shards-per-thread=16] [--front-size=256K] [--merge-ms=10]
+ *                [--ops=2M] [--check=4K] [--universe=16M] [--perf=1] [--json]
+ *
+ * Modes:
+ *  - lockfree: one ConcurrentQHTFilter, Streamed by all threads without locks
+ *  - sharded: a ShardedQHTFilter with shards-per-thread shards per thread, each behind a mutex
+ *  - partitioned: thread-per-shard, one shard per thread used without locks; the input is hashed once (Prehash)
+ *    and partitioned by ShardOfHandle before the measurement, as if the upstream dispatcher already routed the keys,
+ *    and each thread Streams the handles of its shard
+ *  - tiered: a TieredQHTFilter, each thread Streams its own front of front-size bytes without synchronization,
+ *    the global filter being filled by a background merger every merge-ms milliseconds
+ *
+ * The threads share `ops` Streams: each Streams ops / threads keys of its own stream of the workload (see workload.h),
+ * so that the filter takes the same load whatever the number of threads. A skewed workload
+ * (--workloads=zipf, or adversarial) makes threads hit the same cells and shards: this is the contended mode.
+ * Thread t is pinned to CPU t modulo the number of CPUs.
+ *
+ * Reported: throughput, throughput per thread, efficiency (throughput / (threads * throughput with 1 thread)),
+ * recent_miss_rate (fraction of the last check / threads keys of each thread, about the last `check` keys Streamed,
+ * that a Lookup does not find after the run) and fnr_drift (recent_miss_rate minus its value with 1 thread):
+ * at equal load and recency, the false negatives caused by races. Threads that run in turns (more threads than CPUs)
+ * make the last keys of the first threads older: sharded, whose locks rule out races, shows that part of the drift.
+ * Efficiency and drift need the first entry of --threads to be 1. Unless --perf=0, hardware counters are read
+ * by each thread around its own Streams and summed over the threads, then reported per Stream (see perf.h).
+ */
+
+struct Outcome {
+	double seconds;
+	double recent_miss_rate;
+	PerfCounts counts; // summed over the threads
+
+	Outcome() : seconds(0), recent_miss_rate(0), counts() {}
+	Outcome(const double n_seconds, const double n_recent_miss_rate, const PerfCounts& n_counts)
+		: seconds(n_seconds), recent_miss_rate(n_recent_miss_rate), counts(n_counts) {}
+};
+
+template <class Prepare, class Work, class Check> Outcome RunThreads(const size_t n_threads, const bool use_perf, Prepare prepare, Work work, Check check) {
+	/**
+	 * Runs work(t) on n_threads pinned threads started together, then check(t) for each thread.
+	 * If use_perf, each thread counts its own work(t) (counters only count the thread that opened them).
+	 */
+	prepare();
+
+	std::atomic<size_t> ready(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+	std::vector<PerfCounts> counts(n_threads);
+	auto n_cpus = std::max(1u, std::thread::hardware_concurrency());
+
+	for(size_t t = 0; t < n_threads; ++t) {
+		threads.emplace_back([&, t]() {
+			PinToCpu(int(t % n_cpus));
+			PerfCounters perf(use_perf);
+			++ready;
+			while(!go.load(std::memory_order_acquire)) {
+			}
+			perf.Start();
+			work(t);
+			perf.Stop();
+			counts[t] = perf.Read();
+		});
+	}
+
+	while(ready.load() < n_threads) {
+	}
+	Timer timer;
+	go.store(true, std::memory_order_release);
+	for(auto& thread: threads) {
+		thread.join();
+	}
+	auto seconds = timer.Seconds();
+
+	size_t misses = 0, checked = 0;
+	for(size_t t = 0; t < n_threads; ++t) {
+		auto result = check(t);
+		misses += result.first;
+		checked += result.second;
+	}
+
+	PerfCounts total;
+	for(auto& thread_counts: counts) {
+		Accumulate(total, thread_counts);
+	}
+
+	return Outcome(seconds, double(misses) / double(std::max(checked, size_t(1))), total);
+}
+
+int main(int argc, char** argv) {
+	Arguments arguments(argc, argv);
+
+	const uint64_t memory_bits = 8 * arguments.GetSize("size", 256 << 20);
+	const size_t n_buckets = arguments.GetSize("buckets", 3);
+	const size_t fingerprint_size = arguments.GetSize("fingerprint", 5);
+	const size_t shards_per_thread = std::max(uint64_t(1), arguments.GetSize("shards-per-thread", 16));
+	const uint64_t front_bits = 8 * arguments.GetSize("front-size", 256 << 10);
+	const auto merge_period = std::chrono::milliseconds(arguments.GetSize("merge-ms", 10));
+	const size_t n_ops = arguments.GetSize("ops", 2 << 20);
+	const size_t n_checks = arguments.GetSize("check", 4 << 10);
+
+	const bool use_perf = arguments.Get("perf", "1") != "0";
+	WarnIfUnavailable(PerfCounters(use_perf), use_perf);
+
+	Report report(arguments.Has("json"));
+
+	for(auto& workload_name: arguments.GetList("workloads", "uniform,zipf")) {
+		for(auto& mode: arguments.GetList("modes", "lockfree,sharded,partitioned,tiered")) {
+			bool first = true;
+			double single_ops_per_s = 0, single_miss_rate = 0; // with the first entry of --threads, per thread
+
+			for(auto n_threads: arguments.GetSizes("threads", "1,2,4,8")) {
+				// One stream per thread, drawn before the measurement: the threads share the ops and the checks, so that
+				// the filter holds the same number of keys whatever the number of threads
+				const size_t n_thread_ops = std::max(size_t(1), n_ops / n_threads);
+				const size_t n_thread_checks = std::max(size_t(1), n_checks / n_threads);
+				std::vector<std::vector<Key16>> keys(n_threads);
+				for(size_t t = 0; t < n_threads; ++t) {
+					WorkloadOptions options(arguments, 16 << 20);
+					options.workload = workload_name;
+					options.seed += t;
+					options.target_cells = std::max(uint64_t(1), memory_bits / (n_buckets * fingerprint_size));
+					keys[t] = Workload<Key16>(options).Generate(n_thread_ops);
+				}
+
+				auto recent = [&](const auto& stream, const auto& lookup) {
+					size_t misses = 0, checked = 0;
+					for(size_t i = stream.size() - std::min(stream.size(), n_thread_checks); i < stream.size(); ++i, ++checked) {
+						misses += !lookup(stream[i]);
+					}
+					return std::make_pair(misses, checked);
+				};
+
+				Outcome outcome;
+				if(mode == "lockfree") {
+					ConcurrentQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size);
+					outcome = RunThreads(n_threads, use_perf, []() {}, [&](const size_t t) {
+						size_t detected = 0;
+						for(auto& key: keys[t]) {
+							detected += filter.Stream(key);
+						}
+						DoNotOptimize(detected);
+					}, [&](const size_t t) {
+						return recent(keys[t], [&](const Key16& key) { return filter.Lookup(key); });
+					});
+				} else if(mode == "sharded") {
+					ShardedQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size, n_threads * shards_per_thread);
+					outcome = RunThreads(n_threads, use_perf, []() {}, [&](const size_t t) {
+						size_t detected = 0;
+						for(auto& key: keys[t]) {
+							detected += filter.Stream(key);
+						}
+						DoNotOptimize(detected);
+					}, [&](const size_t t) {
+						return recent(keys[t], [&](const Key16& key) { return filter.Lookup(key); });
+					});
+				} else if(mode == "partitioned") {
+					ShardedQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size, n_threads);
+					std::vector<std::vector<KeyHandle>> owned(n_threads);
+					outcome = RunThreads(n_threads, use_perf, [&]() {
+						// Round-robin over the streams, so that each partition keeps the order of the events
+						for(size_t i = 0; i < n_thread_ops; ++i) {
+							for(size_t t = 0; t < n_threads; ++t) {
+								if(i < keys[t].size()) {
+									auto handle = QHTFilter<Key16>::Prehash(keys[t][i]);
+									owned[filter.ShardOfHandle(handle)].push_back(handle);
+								}
+							}
+						}
+					}, [&](const size_t t) {
+						auto& shard = filter.Owned(t);
+						size_t detected = 0;
+						for(auto& handle: owned[t]) {
+							detected += shard.StreamHandle(handle);
+						}
+						DoNotOptimize(detected);
+					}, [&](const size_t t) {
+						return recent(owned[t], [&](const KeyHandle& handle) { return filter.LookupHandle(handle); });
+					});
+				} else if(mode == "tiered") {
+					TieredQHTFilter<Key16> filter(memory_bits, n_buckets, fingerprint_size, n_threads, front_bits, merge_period);
+					outcome = RunThreads(n_threads, use_perf, []() {}, [&](const size_t t) {
+						size_t detected = 0;
+						for(auto& key: keys[t]) {
+							detected += filter.Stream(t, key);
+						}
+						DoNotOptimize(detected);
+					}, [&](const size_t t) {
+						filter.Merge();
+						return recent(keys[t], [&](const Key16& key) { return filter.Lookup(t, key); });
+					});
+				} else {
+					std::fprintf(stderr, "Unknown mode %s\n", mode.c_str());
+					break;
+				}
+
+				const double ops_per_s = double(n_threads * n_thread_ops) / outcome.seconds;
+				if(first) {
+					first = false;
+					single_ops_per_s = ops_per_s / double(n_threads);
+					single_miss_rate = outcome.recent_miss_rate;
+				}
+
+				Record record;
+				record.Add("mode", mode)
+					.Add("workload", workload_name)
+					.Add("threads", n_threads)
+					.Add("memory_bytes", memory_bits / 8)
+					.Add("ops_per_s", ops_per_s)
+					.Add("ops_per_s_per_thread", ops_per_s / double(n_threads))
+					.Add("efficiency", ops_per_s / (double(n_threads) * single_ops_per_s))
+					.Add("recent_miss_rate", outcome.recent_miss_rate)
+					.Add("fnr_drift", outcome.recent_miss_rate - single_miss_rate);
+				PerfCounters::AddCounts(record, outcome.counts, n_threads * n_thread_ops);
+				report.Print(record);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bench.h"
+#include "front.h"
+#include "perf.h"
+#include "qht.h"
+#include "qqhtd.h"
+#include "stash.h"
+#include "twochoice.h"
+#include "workload.h"
+
+/**
+ * Throughput of Stream, Lookup, Insert and Delete, swept over the memory size of the filter
+ * (from L1 to DRAM), the number of buckets per cell, the fingerprint size, the key type and length.
+ *
+ * Usage: throughput [--filters=qht,qqhtd] [--hashes=default] [--sizes=32K,256K,8M,256M] [--buckets=1,2,4]
+ *                   [--fingerprints=1,4,8] [--keys=string,array16,u64] [--lengths=8,32]
+ *                   [--ops=1M] [--load=1] [--max-keys=4M] [--workload=uniform] [--batch=0] [--perf=1] [--cpu=N] [--json]
+ *
+ * Sizes are in bytes. For each configuration, a pool of load * (cells * buckets) keys (at most max-keys) is drawn
+ * from the workload (see workload.h, all keys are distinct by default) and streamed once as a warmup,
+ * then each operation is run `ops` times over the pool.
+ * With --batch=N, StreamBatch and LookupBatch are also measured on batches of N consecutive keys of the pool.
+ * Hashes are the hash policies of the filter (see hash.h): default (DefaultHashPolicy of the key type), xxhash, short,
+ * crc32c, mix, fixed (FixedWidthHashPolicy).
+ * bytes_per_op estimates the memory touched by an operation: the key, plus the words spanned by a cell.
+ * Unless --perf=0, hardware counters per operation are added when available (see perf.h).
+ * When built with -DQHT_ENABLE_PHASE_TIMING, the cycles per operation of each phase of Stream, Lookup and Delete
+ * are added too (see phases.h).
+ */
+
+template <class Operation> double Measure(const size_t n_ops, Operation operation, PerfCounters* perf = nullptr) {
+	/** @returns the time taken by n_ops calls to operation(i), in seconds, with the hardware counters of these calls in perf */
+	ResetPhaseProfile();
+	if(perf != nullptr) {
+		perf->Start();
+	}
+	Timer timer;
+	size_t results = 0;
+
+	for(size_t i = 0; i < n_ops; ++i) {
+		results += operation(i);
+	}
+
+	DoNotOptimize(results);
+	auto seconds = timer.Seconds();
+	if(perf != nullptr) {
+		perf->Stop();
+	}
+	return seconds;
+}
+
+template <class Filter, class Key, class HashPolicy> void Run(Report& report, const Arguments& arguments, PerfCounters& perf, Record configuration,
+	const uint64_t memory_bytes, const size_t n_buckets, const size_t fingerprint_size, const size_t key_length) {
+
+	const uint64_t memory_bits = memory_bytes * 8;
+	const size_t n_ops = arguments.GetSize("ops", 1 << 20);
+	const double load = std::stod(arguments.Get("load", "1"));
+
+	const size_t n_cells = memory_bits / (n_buckets * fingerprint_size);
+	const size_t n_keys = std::max(size_t(1), std::min(size_t(load * n_cells * n_buckets), size_t(arguments.GetSize("max-keys", 4 << 20))));
+
+	WorkloadOptions options(arguments, uint64_t(1) << 62);
+	options.length = key_length;
+	options.target_cells = std::max(size_t(1), n_cells);
+	auto keys = Workload<Key, HashPolicy>(options).Generate(n_keys);
+	if(keys.empty()) {
+		return;
+	}
+
+	Filter filter(memory_bits, n_buckets, fingerprint_size);
+
+	// Warmup: fills the filter and faults its pages in
+	Measure(keys.size(), [&](const size_t i) { return filter.Stream(keys[i]); });
+
+	const double cell_words = 1. + double(n_buckets * fingerprint_size - 1) / 64.;
+	const double key_bytes = std::is_same<Key, std::string>::value ? key_length + sizeof(Key) : sizeof(Key);
+	const double bytes_per_op = key_bytes + 8. * cell_words;
+
+	auto print = [&](const char* operation, const double seconds, const size_t ops) {
+		Record record = configuration;
+		record.Add("op", operation)
+			.Add("ops", ops)
+			.Add("ops_per_s", double(ops) / seconds)
+			.Add("ns_per_op", seconds * 1e9 / double(ops))
+			.Add("bytes_per_op", bytes_per_op);
+		perf.AddTo(record, ops);
+
+		auto profile = CollectPhaseProfile();
+		for(size_t op = 0; kPhaseTimingEnabled && op < kPhaseOperations; ++op) {
+			if(PhaseProfile::OperationName(op) == std::string(operation)) {
+				for(size_t phase = 0; phase < kPhases; ++phase) {
+					record.Add(std::string(PhaseProfile::PhaseName(phase)) + "_cycles", profile.CyclesPerOperation(op, phase));
+				}
+			}
+		}
+		report.Print(record);
+	};
+
+	print("stream", Measure(n_ops, [&](const size_t i) { return filter.Stream(keys[i % keys.size()]); }, &perf), n_ops);
+	print("lookup", Measure(n_ops, [&](const size_t i) { return filter.Lookup(keys[i % keys.size()]); }, &perf), n_ops);
+	print("insert", Measure(n_ops, [&](const size_t i) { return filter.Insert(keys[i % keys.size()]); }, &perf), n_ops);
+	print("delete", Measure(n_ops, [&](const size_t i) { return filter.Delete(keys[i % keys.size()]); }, &perf), n_ops);
+
+	// Batch operations, on consecutive keys of the pool
+	const size_t batch = arguments.GetSize("batch", 0);
+	if(batch > 0 && batch <= keys.size()) {
+		std::unique_ptr<bool[]> results(new bool[batch]);
+		const size_t n_batches = std::max(size_t(1), n_ops / batch);
+		auto first = [&](const size_t i) { return &keys[(i * batch) % (keys.size() - batch + 1)]; };
+
+		print("stream_batch", Measure(n_batches, [&](const size_t i) {
+			filter.StreamBatch(first(i), batch, results.get());
+			return results[0];
+		}, &perf), n_batches * batch);
+		print("lookup_batch", Measure(n_batches, [&](const size_t i) {
+			filter.LookupBatch(first(i), batch, results.get());
+			return results[0];
+		}, &perf), n_batches * batch);
+	}
+}
+
+template <class Key, class HashPolicy> void RunFilters(Report& report, const Arguments& arguments, PerfCounters& perf, const Record& configuration,
+	const uint64_t memory_bytes, const size_t n_buckets, const size_t fingerprint_size, const size_t key_length) {
+
+	for(auto& name: arguments.GetList("filters", "qht,qqhtd")) {
+		Record record = configuration;
+		record.Add("filter", name);
+
+		if(name == "qht") {
+			Run<QHTFilter<Key, HashPolicy>, Key, HashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "qqhtd") {
+			Run<QQHTDFilter<Key, HashPolicy>, Key, HashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "twochoice") {
+			Run<TwoChoiceQHTFilter<Key, HashPolicy>, Key, HashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "stash") {
+			Run<StashedQHTFilter<Key, HashPolicy>, Key, HashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "front") {
+			Run<FrontCachedFilter<Key, HashPolicy>, Key, HashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else {
+			std::fprintf(stderr, "Unknown filter %s\n", name.c_str());
+		}
+	}
+}
+
+template <class Key> void RunHashes(Report& report, const Arguments& arguments, PerfCounters& perf, const Record& configuration,
+	const uint64_t memory_bytes, const size_t n_buckets, const size_t fingerprint_size, const size_t key_length) {
+
+	for(auto& name: arguments.GetList("hashes", "default")) {
+		Record record = configuration;
+		record.Add("hash", name);
+
+		if(name == "default") {
+			RunFilters<Key, DefaultHashPolicy<Key>>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "xxhash") {
+			RunFilters<Key, XXHashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "short") {
+			RunFilters<Key, ShortKeyHashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "crc32c") {
+			RunFilters<Key, Crc32cHashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "mix") {
+			RunFilters<Key, MixHashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else if(name == "fixed") {
+			RunFilters<Key, FixedWidthHashPolicy>(report, arguments, perf, record, memory_bytes, n_buckets, fingerprint_size, key_length);
+		} else {
+			std::fprintf(stderr, "Unknown hash %s\n", name.c_str());
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	Arguments arguments(argc, argv);
+
+	auto cpu = PinToCpu(std::stoi(arguments.Get("cpu", "-1")));
+	if(cpu < 0) {
+		std::fprintf(stderr, "Could not pin the benchmark to a CPU\n");
+	}
+
+	PerfCounters perf(arguments.Get("perf", "1") != "0");
+	WarnIfUnavailable(perf, arguments.Get("perf", "1") != "0");
+
+	Report report(arguments.Has("json"));
+
+	for(auto memory_bytes: arguments.GetSizes("sizes", "32K,256K,8M,256M")) {
+		for(auto n_buckets: arguments.GetSizes("buckets", "1,2,4")) {
+			for(auto fingerprint_size: arguments.GetSizes("fingerprints", "1,4,8")) {
+				for(auto& key_type: arguments.GetList("keys", "string,array16")) {
+					auto lengths = key_type == "string" ? arguments.GetSizes("lengths", "8,32") : std::vector<uint64_t>{key_type == "u64" ? 8u : 16u};
+
+					for(auto key_length: lengths) {
+						Record configuration;
+						configuration.Add("memory_bytes", memory_bytes)
+							.Add("buckets", n_buckets)
+							.Add("fingerprint_bits", fingerprint_size)
+							.Add("key", key_type)
+							.Add("key_bytes", key_length)
+							.Add("cpu", cpu)
+							.Add("isa", std::string(CpuLevelName(GetCpuLevel())));
+
+						if(key_type == "string") {
+							RunHashes<std::string>(report, arguments, perf, configuration, memory_bytes, n_buckets, fingerprint_size, key_length);
+						} else if(key_type == "array16") {
+							RunHashes<Key16>(report, arguments, perf, configuration, memory_bytes, n_buckets, fingerprint_size, key_length);
+						} else if(key_type == "u64") {
+							RunHashes<uint64_t>(report, arguments, perf, configuration, memory_bytes, n_buckets, fingerprint_size, key_length);
+						} else {
+							std::fprintf(stderr, "Unknown key type %s\n", key_type.c_str());
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bench.h"
+#include "hash.h"
+
+/**
+ * Key streams for the benchmarks. Every event is a key together with its identity (id): two events carry the same key
+ * if and only if they carry the same id, which is what the accuracy harness uses as ground truth.
+ *
+ * Workloads (--workload=...):
+ *  - uniform: ids drawn uniformly from [0, universe)
+ *  - duplicates: with probability `duplicates` a previously streamed id (among the last `window` fresh ids, 0 for all),
+ *    otherwise a fresh one
+ *  - zipf: ids drawn from a Zipf distribution of exponent `skew` over the universe (id 0 is the most frequent)
+ *  - bursty: every `burst-period` events a new set of `burst-keys` hot ids is drawn from the universe, each event
+ *    is a hot id with probability `burst-fraction` and a uniform one otherwise
+ *  - adversarial: `adversarial-keys` distinct keys that all fall in the same cell of a filter of `target_cells` cells
+ *    (Hash1(key) % target_cells, with the hash policy of the filter, a parameter of Workload), drawn uniformly.
+ *    target_cells is set by the benchmark from its filter configuration. Finding a key costs about target_cells hashes,
+ *    so the search stops after `adversarial-budget` ids: a large filter then gets fewer keys, which is reported.
+ *    With TwoChoiceQHTFilter, the keys share their first cell only (sharing both would cost target_cells^2 hashes).
+ *  - trace: replays the keys of a file (`trace`), mapped in memory, either one key per line (`trace-format=lines`)
+ *    or each key preceded by its length as a 32-bit little-endian integer (`trace-format=u32`). The stream ends with the file.
+ *
+ * Synthetic string keys are `length` bytes long, plus up to `length-spread` bytes depending on the id.
+ * Fixed-width keys (Key16, uint64_t) are derived from the id only, including for traces.
+ *
+ * Generating a key costs a few hashes (a string key also allocates), after the search of the adversarial keys:
+ * benchmarks that time the filter generate their keys up front with Generate(), so that the generator never bottlenecks
+ * the measurement.
+ */
+
+typedef std::array<uint8_t, 16> Key16;
+
+inline uint64_t Mix(uint64_t x) {
+	/** splitmix64 finalizer, used to draw keys and to sample them independently from the filter hashes */
+	x += 0x9e3779b97f4a7c15;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
+inline Key16 MakeKey(const uint64_t id) {
+	Key16 key = {};
+	auto a = Mix(id), b = Mix(id ^ 0x5555555555555555);
+	for(size_t i = 0; i < 8; ++i) {
+		key[i] = uint8_t(a >> (8 * i));
+		key[8 + i] = uint8_t(b >> (8 * i));
+	}
+	return key;
+}
+
+template <class Key> Key SyntheticKey(const uint64_t id, const size_t length);
+
+template <> inline Key16 SyntheticKey<Key16>(const uint64_t id, const size_t) {
+	return MakeKey(id);
+}
+
+template <> inline uint64_t SyntheticKey<uint64_t>(const uint64_t id, const size_t) {
+	return Mix(id);
+}
+
+template <> inline std::string SyntheticKey<std::string>(const uint64_t id, const size_t length) {
+	std::string key(length, '\0');
+	for(size_t i = 0; i < length; i += 8) {
+		auto bits = Mix(id * 0x100000001b3 + i);
+		std::memcpy(&key[i], &bits, std::min(size_t(8), length - i));
+	}
+	return key;
+}
+
+template <class Key> Key TraceKey(const uint64_t id, const char* data, const size_t length);
+
+template <> inline Key16 TraceKey<Key16>(const uint64_t id, const char*, const size_t) {
+	return MakeKey(id);
+}
+
+template <> inline uint64_t TraceKey<uint64_t>(const uint64_t id, const char*, const size_t) {
+	return Mix(id);
+}
+
+template <> inline std::string TraceKey<std::string>(const uint64_t, const char* data, const size_t length) {
+	return std::string(data, length);
+}
+
+struct WorkloadOptions {
+	std::string workload;
+	uint64_t universe;
+	double duplicates;
+	uint64_t window;
+	double skew;
+	uint64_t burst_period;
+	uint64_t burst_keys;
+	double burst_fraction;
+	uint64_t adversarial_keys;
+	uint64_t adversarial_budget;
+	uint64_t target_cells;
+	size_t length;
+	size_t length_spread;
+	std::string trace;
+	std::string trace_format;
+	uint64_t seed;
+
+	WorkloadOptions(const Arguments& arguments, const uint64_t default_universe)
+		: workload(arguments.Get("workload", "uniform")),
+		  universe(std::max(uint64_t(1), arguments.GetSize("universe", default_universe))),
+		  duplicates(std::stod(arguments.Get("duplicates", "0.5"))),
+		  window(arguments.GetSize("window", 0)),
+		  skew(std::stod(arguments.Get("skew", "0.99"))),
+		  burst_period(std::max(uint64_t(1), arguments.GetSize("burst-period", 1 << 16))),
+		  burst_keys(std::max(uint64_t(1), arguments.GetSize("burst-keys", 1 << 10))),
+		  burst_fraction(std::stod(arguments.Get("burst-fraction", "0.5"))),
+		  adversarial_keys(std::max(uint64_t(1), arguments.GetSize("adversarial-keys", 64))),
+		  adversarial_budget(arguments.GetSize("adversarial-budget", 64 << 20)),
+		  target_cells(1),
+		  length(arguments.GetSize("length", 16)),
+		  length_spread(arguments.GetSize("length-spread", 0)),
+		  trace(arguments.Get("trace", "")),
+		  trace_format(arguments.Get("trace-format", "lines")),
+		  seed(std::stoull(arguments.Get("seed", "42"))) {
+	}
+};
+
+class ZipfDistribution {
+	/**
+	 * Zipf distribution over [0, n): P(k) proportional to 1 / (k + 1)^s, sampled in constant time
+	 * by rejection-inversion (Hörmann & Derflinger, 1996)
+	 */
+	double s;
+	double h_integral_x1;
+	double h_integral_n;
+	double threshold;
+	uint64_t n;
+
+	static double Helper1(const double x) { return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1. - x * (.5 - x * (1. / 3. - .25 * x)); }
+	static double Helper2(const double x) { return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1. + x * .5 * (1. + x / 3. * (1. + .25 * x)); }
+
+	double H(const double x) const { auto log_x = std::log(x); return Helper2((1. - s) * log_x) * log_x; }
+	double HInverse(const double x) const { return std::exp(Helper1(std::max(-1., x * (1. - s))) * x); }
+	double h(const double x) const { return std::exp(-s * std::log(x)); }
+
+public:
+	ZipfDistribution(const uint64_t n_n, const double n_s)
+		: s(n_s), h_integral_x1(0), h_integral_n(0), threshold(0), n(n_n) {
+		h_integral_x1 = H(1.5) - 1.;
+		h_integral_n = H(double(n) + .5);
+		threshold = 2. - HInverse(H(2.5) - h(2.));
+	}
+
+	template <class Rng> uint64_t operator()(Rng& rng) {
+		std::uniform_real_distribution<double> uniform(0., 1.);
+		while(true) {
+			auto u = h_integral_n + uniform(rng) * (h_integral_x1 - h_integral_n);
+			auto x = HInverse(u);
+			auto k = std::min(std::max(std::floor(x + .5), 1.), double(n));
+			if(k - x <= threshold || u >= H(k + .5) - h(k)) {
+				return uint64_t(k) - 1;
+			}
+		}
+	}
+};
+
+class MappedFile {
+	/** Read-only memory mapping of a whole file */
+	const char* data;
+	size_t size;
+
+public:
+	explicit MappedFile(const std::string& path) : data(nullptr), size(0) {
+#ifdef __unix__
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat status;
+		if(fd < 0 || fstat(fd, &status) != 0) {
+			if(fd >= 0) {
+				close(fd);
+			}
+			throw std::runtime_error("Cannot open trace " + path);
+		}
+
+		size = size_t(status.st_size);
+		if(size > 0) {
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(mapping == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error("Cannot map trace " + path);
+			}
+			madvise(mapping, size, MADV_SEQUENTIAL);
+			data = static_cast<const char*>(mapping);
+		}
+		close(fd);
+#else
+		throw std::runtime_error("Trace replay is not supported on this platform: " + path);
+#endif
+	}
+
+	~MappedFile() {
+#ifdef __unix__
+		if(data != nullptr) {
+			munmap(const_cast<char*>(data), size);
+		}
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* Data() const { return data; }
+	size_t Size() const { return size; }
+};
+
+template <class Key, class HashPolicy = DefaultHashPolicy<Key>> class Workload {
+	WorkloadOptions options;
+	std::mt19937_64 rng;
+	std::uniform_int_distribution<uint64_t> uniform;
+	std::bernoulli_distribution coin;
+	ZipfDistribution zipf;
+
+	uint64_t n_events;
+	uint64_t n_fresh;
+	std::vector<uint64_t> pool; // hot ids of the current burst, or colliding ids of the adversarial workload
+
+	std::unique_ptr<MappedFile> trace;
+	size_t trace_offset;
+
+	enum Kind {kUniform, kDuplicates, kZipf, kBursty, kAdversarial, kTrace} kind;
+
+	size_t Length(const uint64_t id) const {
+		return options.length + (options.length_spread == 0 ? 0 : Mix(id ^ 0x3c3c3c3c3c3c3c3c) % (options.length_spread + 1));
+	}
+
+	void FindCollisions() {
+		/** Collects the ids whose keys fall in the cell of id 0, among the first adversarial_budget ids */
+		auto cell_of = [&](const uint64_t id) { return PolicyHash1<HashPolicy>(SyntheticKey<Key>(id, Length(id))) % options.target_cells; };
+		auto target = cell_of(0);
+		pool.push_back(0);
+		for(uint64_t id = 1; pool.size() < options.adversarial_keys && id < options.adversarial_budget; ++id) {
+			if(cell_of(id) == target) {
+				pool.push_back(id);
+			}
+		}
+
+		if(pool.size() < options.adversarial_keys) {
+			std::fprintf(stderr, "Adversarial workload: %zu of %llu keys found in one of %llu cells within %llu ids (see --adversarial-budget)\n",
+				pool.size(), (unsigned long long)options.adversarial_keys, (unsigned long long)options.target_cells,
+				(unsigned long long)options.adversarial_budget);
+		}
+	}
+
+	bool NextTrace(Key& key, uint64_t& id) {
+		auto data = trace->Data() + trace_offset;
+		auto remaining = trace->Size() - trace_offset;
+		size_t length, skip;
+
+		if(options.trace_format == "u32") {
+			if(remaining < 4) {
+				return false;
+			}
+			uint32_t prefix = 0;
+			for(size_t i = 0; i < 4; ++i) {
+				prefix |= uint32_t(uint8_t(data[i])) << (8 * i);
+			}
+			data += 4;
+			length = std::min(size_t(prefix), remaining - 4);
+			skip = 4 + length;
+		} else {
+			if(remaining == 0) {
+				return false;
+			}
+			auto end = static_cast<const char*>(std::memchr(data, '\n', remaining));
+			length = end == nullptr ? remaining : size_t(end - data);
+			skip = end == nullptr ? remaining : length + 1;
+		}
+
+		trace_offset += skip;
+		id = xxh::xxhash<64>(data, length, 0x5bd1e9955bd1e995);
+		key = TraceKey<Key>(id, data, length);
+		return true;
+	}
+
+public:
+	explicit Workload(const WorkloadOptions& n_options)
+		: options(n_options), rng(n_options.seed), uniform(0, n_options.universe - 1), coin(0.), zipf(n_options.universe, n_options.skew),
+		  n_events(0), n_fresh(0), pool(), trace(), trace_offset(0), kind(kUniform) {
+
+		if(options.workload == "uniform") {
+			kind = kUniform;
+		} else if(options.workload == "duplicates") {
+			kind = kDuplicates;
+			coin = std::bernoulli_distribution(options.duplicates);
+		} else if(options.workload == "zipf") {
+			kind = kZipf;
+		} else if(options.workload == "bursty") {
+			kind = kBursty;
+			coin = std::bernoulli_distribution(options.burst_fraction);
+		} else if(options.workload == "adversarial") {
+			kind = kAdversarial;
+			FindCollisions();
+			uniform = std::uniform_int_distribution<uint64_t>(0, pool.size() - 1);
+		} else if(options.workload == "trace") {
+			kind = kTrace;
+			trace.reset(new MappedFile(options.trace));
+		} else {
+			throw std::invalid_argument("Unknown workload " + options.workload);
+		}
+	}
+
+	Workload(const Workload&) = delete;
+	Workload& operator=(const Workload&) = delete;
+
+	uint64_t NextId() {
+		/** Identity of the next synthetic event */
+		switch(kind) {
+		case kDuplicates: {
+			if(n_fresh == 0 || !coin(rng)) {
+				return n_fresh++;
+			}
+			auto oldest = options.window == 0 || options.window >= n_fresh ? 0 : n_fresh - options.window;
+			return std::uniform_int_distribution<uint64_t>(oldest, n_fresh - 1)(rng);
+		}
+		case kZipf:
+			return zipf(rng);
+		case kBursty:
+			if(n_events++ % options.burst_period == 0) {
+				pool.clear();
+				for(uint64_t i = 0; i < options.burst_keys; ++i) {
+					pool.push_back(uniform(rng));
+				}
+			}
+			return coin(rng) ? pool[rng() % pool.size()] : uniform(rng);
+		case kAdversarial:
+			return pool[uniform(rng)];
+		default:
+			return uniform(rng);
+		}
+	}
+
+	bool Next(Key& key, uint64_t& id) {
+		/**
+		 * Draws the next event
+		 * @returns false once a trace is exhausted, synthetic workloads never end
+		 */
+		if(kind == kTrace) {
+			return NextTrace(key, id);
+		}
+
+		id = NextId();
+		key = SyntheticKey<Key>(id, Length(id));
+		return true;
+	}
+
+	std::vector<Key> Generate(const size_t n_keys, std::vector<uint64_t>* ids = nullptr) {
+		/** Draws up to n_keys events (fewer if a trace ends), and their ids if requested */
+		std::vector<Key> keys;
+		keys.reserve(n_keys);
+		Key key;
+		uint64_t id;
+		while(keys.size() < n_keys && Next(key, id)) {
+			keys.push_back(key);
+			if(ids != nullptr) {
+				ids->push_back(id);
+			}
+		}
+		return keys;
+	}
+};
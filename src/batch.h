@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "cpu.h"
+#include "hash.h"
+
+/**
+ * Hashing of a batch of keys, for the batch operations of the filters (see QHTFilter::StreamBatch).
+ *
+ * With FixedWidthHashPolicy, keys of up to 8 bytes are one word each and their mix (the murmur3 finalizer,
+ * see hash_detail::MixBytes) is computed for 4 (AVX2) or 8 (AVX-512) keys at once, the variant being selected
+ * at runtime (see cpu.h). The hashes are exactly those of the scalar path, so batch and single-key operations
+ * can be mixed. Other policies and wider keys are hashed one key at a time.
+ */
+
+/** Number of keys hashed and prefetched together by the batch operations */
+const size_t kBatchSize = 32;
+
+namespace hash_detail {
+
+inline void FmixWordsBaseline(const uint64_t* words, const size_t n, const uint64_t salt, uint64_t* hashes) {
+	/** hashes[i] = Fmix64(words[i] ^ salt) */
+	for(size_t i = 0; i < n; ++i) {
+		hashes[i] = Fmix64(words[i] ^ salt);
+	}
+}
+
+#if QHT_X86_DISPATCH
+
+QHT_TARGET_AVX2 inline __m256i MulLow64Avx2(const __m256i a, const __m256i b) {
+	/** Low 64 bits of the lane products, from 32x32-bit products (AVX2 has no 64-bit multiplication) */
+	auto cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+	return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+QHT_TARGET_AVX2 inline void FmixWordsAvx2(const uint64_t* words, const size_t n, const uint64_t salt, uint64_t* hashes) {
+	const auto k = _mm256_set1_epi64x(int64_t(salt));
+	const auto c1 = _mm256_set1_epi64x(int64_t(0xff51afd7ed558ccd));
+	const auto c2 = _mm256_set1_epi64x(int64_t(0xc4ceb9fe1a85ec53));
+
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		auto h = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i)), k);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+		h = MulLow64Avx2(h, c1);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+		h = MulLow64Avx2(h, c2);
+		h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 33));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i), h);
+	}
+	FmixWordsBaseline(words + i, n - i, salt, hashes + i);
+}
+
+QHT_TARGET_AVX512 inline void FmixWordsAvx512(const uint64_t* words, const size_t n, const uint64_t salt, uint64_t* hashes) {
+	const auto k = _mm512_set1_epi64(int64_t(salt));
+	const auto c1 = _mm512_set1_epi64(int64_t(0xff51afd7ed558ccd));
+	const auto c2 = _mm512_set1_epi64(int64_t(0xc4ceb9fe1a85ec53));
+
+	// Shifts are zero-masked (all lanes kept): the unmasked intrinsic trips -Wmaybe-uninitialized in some GCC versions
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		auto h = _mm512_xor_si512(_mm512_loadu_si512(words + i), k);
+		h = _mm512_xor_si512(h, _mm512_maskz_srli_epi64(0xff, h, 33));
+		h = _mm512_mullo_epi64(h, c1);
+		h = _mm512_xor_si512(h, _mm512_maskz_srli_epi64(0xff, h, 33));
+		h = _mm512_mullo_epi64(h, c2);
+		h = _mm512_xor_si512(h, _mm512_maskz_srli_epi64(0xff, h, 33));
+		_mm512_storeu_si512(hashes + i, h);
+	}
+	FmixWordsBaseline(words + i, n - i, salt, hashes + i);
+}
+
+#endif
+
+typedef void (*FmixWordsKernel)(const uint64_t*, const size_t, const uint64_t, uint64_t*);
+
+inline FmixWordsKernel SelectFmixWords() {
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return FmixWordsAvx512;
+	case kCpuAvx2: return FmixWordsAvx2;
+	default: return FmixWordsBaseline;
+	}
+#else
+	return FmixWordsBaseline;
+#endif
+}
+
+inline void FmixWords(const uint64_t* words, const size_t n, const uint64_t salt, uint64_t* hashes) {
+	/** hashes[i] = Fmix64(words[i] ^ salt), several words at a time on CPUs with wide vectors */
+	static const FmixWordsKernel kernel = SelectFmixWords();
+	kernel(words, n, salt, hashes);
+}
+
+}
+
+template<class Policy, class T> void HashBatch(const T* keys, const size_t n, KeyHandle* handles) {
+	/**
+	 * Prehash of n keys at once
+	 * @param keys: n keys
+	 * @param n: number of keys, at most kBatchSize
+	 * @param handles: output, hashes of the keys, as QHTFilter::Prehash would compute them
+	 */
+	if constexpr(std::is_same<Policy, FixedWidthHashPolicy>::value && std::has_unique_object_representations_v<T> && sizeof(T) <= 8) {
+		using namespace hash_detail;
+		uint64_t words[kBatchSize] = {}, hashes[kBatchSize];
+		for(size_t i = 0; i < n; ++i) {
+			words[i] = LoadTail(reinterpret_cast<const uint8_t*>(keys + i), sizeof(T));
+		}
+
+		// Same mix as MixBytes for keys of sizeof(T) bytes: the salt only depends on the size
+		FmixWords(words, n, Fmix64(kHash1Seed ^ (sizeof(T) * kPrime2)), hashes);
+
+		for(size_t i = 0; i < n; ++i) {
+			handles[i] = FixedWidthHashPolicy::Split(hashes[i]);
+		}
+	} else {
+		for(size_t i = 0; i < n; ++i) {
+			const auto& key = PolicyKey<Policy>(keys[i]);
+			handles[i] = KeyHandle{PolicyHash1<Policy>(key), PolicyHash2<Policy>(key)};
+		}
+	}
+}
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "packed.h"
+#include "qht.h"
+
+/**
+ * Filters shared by several threads.
+ *
+ *  - ConcurrentQHTFilter: one QHT that all threads Lookup and Stream without locks
+ *  - ShardedQHTFilter: independent QHTs, each behind a mutex, a key always goes to the same shard.
+ *    A thread that owns a set of shards (its input being partitioned with ShardOf) can also use them without locks.
+ *    Operations on keys hash them once for both the shard and the cell; a dispatcher that partitions the input can
+ *    do the same with Prehash and ShardOfHandle, and hand the handles to the owners.
+ *  - TieredQHTFilter: a small QHT per thread, checked first without any synchronization, in front of a large global
+ *    ConcurrentQHTFilter that the threads read lock-free and that a background merger fills with the keys they missed
+ */
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct ConcurrentQHTFilter : QHTFilter<T, HashPolicy> {
+	/**
+	 * Buckets are read and written with relaxed atomic word operations (see WriteBitsRelaxed): a write never overwrites
+	 * other buckets, but two threads inserting in the same cell at the same time may pick the same bucket, in which case
+	 * one of the fingerprints is lost (a false negative later on). Evictions use a random generator per thread.
+	 *
+	 * Safe to call concurrently: Lookup, Insert and Stream on a key, its bytes, its handle or its parts (and fields),
+	 * LookupBatch, StreamBatch, and Prehash. Stats are not maintained, and the other operations (Delete, DeleteHandle,
+	 * Reset, Merge, Diff, ApplyDelta, Snapshot, Restore...) must not run concurrently with any operation.
+	 */
+
+protected:
+	uint64_t GetFingerprintRelaxed(const uint64_t address, const size_t bucket_number) const;
+	bool InsertRelaxed(const uint64_t address, const uint64_t fingerprint);
+	template <class K> bool LookupKey(const K& e);
+	template <class K> bool InsertKey(const K& e);
+	template <class K> bool StreamKey(const K& e);
+
+public:
+	ConcurrentQHTFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size);
+	bool Lookup(const T& e) { return LookupKey(e); }
+	bool Insert(const T& e) { return InsertKey(e); }
+	bool Stream(const T& e) { return StreamKey(e); }
+
+	// Same operations on the bytes of a key (see KeyBytes), its hashes (see Prehash) or its parts (see PrehashParts)
+	bool Lookup(const std::string_view bytes) { return LookupKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Insert(const std::string_view bytes) { return InsertKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Stream(const std::string_view bytes) { return StreamKey(KeyBytes{bytes.data(), bytes.size()}); }
+	template <class C, IfCString<C> = 0> bool Lookup(const C* bytes) { return Lookup(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Insert(const C* bytes) { return Insert(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	bool Lookup(const void* data, const size_t size) { return LookupKey(KeyBytes{data, size}); }
+	bool Insert(const void* data, const size_t size) { return InsertKey(KeyBytes{data, size}); }
+	bool Stream(const void* data, const size_t size) { return StreamKey(KeyBytes{data, size}); }
+	bool LookupHandle(const KeyHandle& handle) { return LookupKey(handle); }
+	bool InsertHandle(const KeyHandle& handle) { return InsertKey(handle); }
+	bool StreamHandle(const KeyHandle& handle) { return StreamKey(handle); }
+	bool LookupParts(const std::initializer_list<KeyBytes> parts) { return LookupKey(this->PrehashParts(parts)); }
+	bool StreamParts(const std::initializer_list<KeyBytes> parts) { return StreamKey(this->PrehashParts(parts)); }
+	template <class... Fields> bool LookupFields(const Fields&... fields) { return LookupKey(this->PrehashFields(fields...)); }
+	template <class... Fields> bool StreamFields(const Fields&... fields) { return StreamKey(this->PrehashFields(fields...)); }
+#if QHT_IOVEC
+	bool LookupParts(const iovec* ranges, const size_t count) { return LookupKey(this->PrehashParts(ranges, count)); }
+	bool StreamParts(const iovec* ranges, const size_t count) { return StreamKey(this->PrehashParts(ranges, count)); }
+#endif
+
+	void LookupBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return LookupKey(handle); });
+	}
+	void StreamBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return StreamKey(handle); });
+	}
+};
+
+template <class T, class HashPolicy> ConcurrentQHTFilter<T, HashPolicy>::ConcurrentQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_n_buckets,
+	const size_t n_fingerprint_size
+) : QHTFilter<T, HashPolicy>(memory_size, n_n_buckets, n_fingerprint_size) {
+}
+
+template <class T, class HashPolicy> uint64_t ConcurrentQHTFilter<T, HashPolicy>::GetFingerprintRelaxed(const uint64_t address, const size_t bucket_number) const {
+	auto offset = (address * this->n_buckets + bucket_number) * this->fingerprint_size;
+	return ReadBitsRelaxed(this->qht.data(), offset, this->fingerprint_size);
+}
+
+template <class T, class HashPolicy> bool ConcurrentQHTFilter<T, HashPolicy>::InsertRelaxed(const uint64_t address, const uint64_t fingerprint) {
+	/**
+	 * Same policy as QHTFilter::InsertInCell: first empty bucket, or a random one if the cell is full
+	 * @returns true if the fingerprint was already in the cell
+	 */
+	thread_local std::mt19937 generator(std::random_device{}());
+
+	size_t empty_bucket = this->n_buckets;
+	for(size_t bucket_number = 0; bucket_number < this->n_buckets; ++bucket_number) {
+		auto current_fingerprint = GetFingerprintRelaxed(address, bucket_number);
+
+		if(current_fingerprint == fingerprint) {
+			return true;
+		}
+		if(current_fingerprint == 0 && empty_bucket == this->n_buckets) {
+			empty_bucket = bucket_number;
+		}
+	}
+
+	if(empty_bucket == this->n_buckets) {
+		empty_bucket = std::uniform_int_distribution<size_t>(0, this->n_buckets - 1)(generator);
+	}
+
+	auto offset = (address * this->n_buckets + empty_bucket) * this->fingerprint_size;
+	WriteBitsRelaxed(this->qht.data(), offset, this->fingerprint_size, fingerprint);
+
+	return false;
+}
+
+template <class T, class HashPolicy> template <class K> bool ConcurrentQHTFilter<T, HashPolicy>::LookupKey(const K& e) {
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	auto fingerprint = this->Fingerprint(key);
+
+	for(size_t i = 0; i < this->n_buckets; ++i) {
+		if(GetFingerprintRelaxed(address, i) == fingerprint) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template <class T, class HashPolicy> template <class K> bool ConcurrentQHTFilter<T, HashPolicy>::InsertKey(const K& e) {
+	const auto& key = PolicyKey<HashPolicy>(e);
+	InsertRelaxed(this->Address(key), this->Fingerprint(key));
+	return true;
+}
+
+template <class T, class HashPolicy> template <class K> bool ConcurrentQHTFilter<T, HashPolicy>::StreamKey(const K& e) {
+	/** @returns true if e was already in the filter, false otherwise (e is then inserted) */
+	const auto& key = PolicyKey<HashPolicy>(e);
+	return InsertRelaxed(this->Address(key), this->Fingerprint(key));
+}
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>> class ShardedQHTFilter {
+	/** Shards are aligned on cache lines, so that the mutexes of two shards never share one */
+	struct alignas(64) Shard {
+		std::mutex mutex;
+		QHTFilter<T, HashPolicy> filter;
+
+		Shard(const uint64_t memory_size, const size_t n_buckets, const size_t fingerprint_size)
+			: mutex(), filter(memory_size, n_buckets, fingerprint_size) {}
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+
+	size_t ShardOfHash(const HashValue hash1) const;
+
+public:
+	ShardedQHTFilter(const uint64_t memory_size, const size_t n_buckets, const size_t fingerprint_size, const size_t n_shards);
+
+	size_t Shards() const { return shards.size(); }
+	size_t ShardOf(const T& e) const { return ShardOfHash(PolicyHash1<HashPolicy>(e)); }
+	size_t ShardOfHandle(const KeyHandle& handle) const { return ShardOfHash(handle.hash1); }
+	QHTFilter<T, HashPolicy>& Owned(const size_t shard) { return shards[shard]->filter; }
+
+	bool Lookup(const T& e);
+	bool Insert(const T& e);
+	bool Stream(const T& e);
+	bool Delete(const T& e);
+	void Reset();
+
+	// With a handle from QHTFilter<T, HashPolicy>::Prehash, the key is hashed once for both the shard and the cell
+	bool LookupHandle(const KeyHandle& handle);
+	bool InsertHandle(const KeyHandle& handle);
+	bool StreamHandle(const KeyHandle& handle);
+	bool DeleteHandle(const KeyHandle& handle);
+};
+
+template <class T, class HashPolicy> ShardedQHTFilter<T, HashPolicy>::ShardedQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_buckets,
+	const size_t fingerprint_size,
+	const size_t n_shards
+) : shards() {
+	/**
+	 * @param memory_size: number of bits of the whole filter, split evenly among the shards
+	 * @param n_shards: number of shards, typically a few times the number of threads
+	 */
+	assert(n_shards > 0);
+	for(size_t i = 0; i < n_shards; ++i) {
+		shards.emplace_back(new Shard(memory_size / n_shards, n_buckets, fingerprint_size));
+	}
+}
+
+template <class T, class HashPolicy> size_t ShardedQHTFilter<T, HashPolicy>::ShardOfHash(const HashValue hash1) const {
+	/**
+	 * The shard is taken from the high bits of a multiplicative hash of Hash1, so that it does not select
+	 * the same cells in every shard (cells come from Hash1 modulo the number of cells)
+	 */
+	return size_t((uint64_t(hash1) * 0x9e3779b97f4a7c15) >> 32) % shards.size();
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::Lookup(const T& e) {
+	return LookupHandle(QHTFilter<T, HashPolicy>::Prehash(e));
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::Insert(const T& e) {
+	return InsertHandle(QHTFilter<T, HashPolicy>::Prehash(e));
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::Stream(const T& e) {
+	return StreamHandle(QHTFilter<T, HashPolicy>::Prehash(e));
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::Delete(const T& e) {
+	return DeleteHandle(QHTFilter<T, HashPolicy>::Prehash(e));
+}
+
+template <class T, class HashPolicy> void ShardedQHTFilter<T, HashPolicy>::Reset() {
+	for(auto& shard: shards) {
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		shard->filter.Reset();
+	}
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::LookupHandle(const KeyHandle& handle) {
+	auto& shard = *shards[ShardOfHandle(handle)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return shard.filter.LookupHandle(handle);
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::InsertHandle(const KeyHandle& handle) {
+	auto& shard = *shards[ShardOfHandle(handle)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return shard.filter.InsertHandle(handle);
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::StreamHandle(const KeyHandle& handle) {
+	auto& shard = *shards[ShardOfHandle(handle)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return shard.filter.StreamHandle(handle);
+}
+
+template <class T, class HashPolicy> bool ShardedQHTFilter<T, HashPolicy>::DeleteHandle(const KeyHandle& handle) {
+	auto& shard = *shards[ShardOfHandle(handle)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	return shard.filter.DeleteHandle(handle);
+}
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>> class TieredQHTFilter {
+	/**
+	 * Each thread owns a front: a small QHT (sized to stay in L2) that it Streams without synchronization.
+	 * A key that misses its front is looked up in the global filter, a ConcurrentQHTFilter read without locks, and if it
+	 * misses there too, its handle is queued in the front. A merger inserts the queued handles into the global filter,
+	 * every merge_period from a background thread, or on calls to Merge. When the queue of a front is full (the merger
+	 * lagging behind, or no merge period and no call to Merge), its thread inserts the key into the global filter itself.
+	 *
+	 * The global filter has its own geometry, so fronts cannot be merged cell by cell (see QHTFilter::Merge):
+	 * the keys are carried as handles (see QHTFilter::Prehash), which give their cell in any geometry.
+	 * Staleness is bounded by the merge period: until the merge after its first occurrence on a thread, a key is not
+	 * detected by the other threads. The fronts and their queues come on top of the memory of the global filter.
+	 */
+
+	/** Single-producer (the thread of the front), single-consumer (the merger) ring of handles */
+	struct alignas(64) Front {
+		QHTFilter<T, HashPolicy> filter;
+		std::vector<KeyHandle> queue;
+		alignas(64) std::atomic<size_t> head; // Next slot written by the thread
+		alignas(64) std::atomic<size_t> tail; // Next slot read by the merger
+
+		Front(const uint64_t memory_size, const size_t n_buckets, const size_t fingerprint_size, const size_t n_queued)
+			: filter(memory_size, n_buckets, fingerprint_size), queue(n_queued), head(0), tail(0) {}
+
+		bool Push(const KeyHandle& handle) {
+			/** @returns false if the queue is full */
+			auto position = head.load(std::memory_order_relaxed);
+			if(position - tail.load(std::memory_order_acquire) == queue.size()) {
+				return false;
+			}
+			queue[position & (queue.size() - 1)] = handle;
+			head.store(position + 1, std::memory_order_release);
+			return true;
+		}
+	};
+
+	std::vector<std::unique_ptr<Front>> fronts;
+	ConcurrentQHTFilter<T, HashPolicy> global;
+
+	std::chrono::milliseconds merge_period;
+	std::mutex merge_mutex; // Only one merger drains the queues at a time
+	std::mutex merger_mutex;
+	std::condition_variable merger_wakeup;
+	bool stopping;
+	std::thread merger;
+
+	void RunMerger();
+
+public:
+	TieredQHTFilter(const uint64_t memory_size, const size_t n_buckets, const size_t fingerprint_size, const size_t n_threads,
+		const uint64_t front_memory_size = 2 << 20, const std::chrono::milliseconds n_merge_period = std::chrono::milliseconds(10),
+		const size_t n_queued = 1 << 16);
+	~TieredQHTFilter();
+
+	size_t Threads() const { return fronts.size(); }
+
+	// Operations of thread `thread` (from 0 to Threads() - 1), a thread must always use the same index
+	bool Lookup(const size_t thread, const T& e) { return LookupHandle(thread, QHTFilter<T, HashPolicy>::Prehash(e)); }
+	bool Stream(const size_t thread, const T& e) { return StreamHandle(thread, QHTFilter<T, HashPolicy>::Prehash(e)); }
+	bool LookupHandle(const size_t thread, const KeyHandle& handle);
+	bool StreamHandle(const size_t thread, const KeyHandle& handle);
+
+	void Merge();
+};
+
+template <class T, class HashPolicy> TieredQHTFilter<T, HashPolicy>::TieredQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_buckets,
+	const size_t fingerprint_size,
+	const size_t n_threads,
+	const uint64_t front_memory_size,
+	const std::chrono::milliseconds n_merge_period,
+	const size_t n_queued
+) : fronts(), global(memory_size, n_buckets, fingerprint_size), merge_period(n_merge_period),
+	merge_mutex(), merger_mutex(), merger_wakeup(), stopping(false), merger() {
+	/**
+	 * @param memory_size: number of bits of the global filter
+	 * @param n_threads: number of fronts, one per thread
+	 * @param front_memory_size: number of bits of each front, 256 KB by default
+	 * @param n_merge_period: time between two merges of the background thread. If zero, there is no background
+	 *                        thread: the caller runs Merge, otherwise the threads insert their misses themselves
+	 *                        once their queues are full
+	 * @param n_queued: capacity of the queue of each front, rounded up to a power of two (16 bytes per handle)
+	 */
+	assert(n_threads > 0);
+	size_t capacity = 1;
+	while(capacity < n_queued) {
+		capacity *= 2;
+	}
+	for(size_t i = 0; i < n_threads; ++i) {
+		fronts.emplace_back(new Front(front_memory_size, n_buckets, fingerprint_size, capacity));
+	}
+
+	if(merge_period.count() > 0) {
+		merger = std::thread([this]() { RunMerger(); });
+	}
+}
+
+template <class T, class HashPolicy> TieredQHTFilter<T, HashPolicy>::~TieredQHTFilter() {
+	{
+		std::lock_guard<std::mutex> lock(merger_mutex);
+		stopping = true;
+	}
+	merger_wakeup.notify_one();
+	if(merger.joinable()) {
+		merger.join();
+	}
+}
+
+template <class T, class HashPolicy> void TieredQHTFilter<T, HashPolicy>::RunMerger() {
+	std::unique_lock<std::mutex> lock(merger_mutex);
+	while(!merger_wakeup.wait_for(lock, merge_period, [this]() { return stopping; })) {
+		lock.unlock();
+		Merge();
+		lock.lock();
+	}
+}
+
+template <class T, class HashPolicy> bool TieredQHTFilter<T, HashPolicy>::LookupHandle(const size_t thread, const KeyHandle& handle) {
+	/** @returns true if the key is in the front of the thread or in the global filter */
+	return fronts[thread]->filter.LookupHandle(handle) || global.LookupHandle(handle);
+}
+
+template <class T, class HashPolicy> bool TieredQHTFilter<T, HashPolicy>::StreamHandle(const size_t thread, const KeyHandle& handle) {
+	/**
+	 * Streams the key in the front of the thread, and on a miss looks it up in the global filter
+	 * @returns true if the key was in the front or in the global filter, false otherwise (it is then queued for the global filter)
+	 */
+	auto& front = *fronts[thread];
+	if(front.filter.StreamHandle(handle) || global.LookupHandle(handle)) {
+		return true;
+	}
+
+	if(!front.Push(handle)) {
+		global.InsertHandle(handle);
+	}
+	return false;
+}
+
+template <class T, class HashPolicy> void TieredQHTFilter<T, HashPolicy>::Merge() {
+	/**
+	 * Inserts the keys queued by every front into the global filter.
+	 * Can run concurrently with the operations of the threads (and with the background merger).
+	 */
+	std::lock_guard<std::mutex> lock(merge_mutex);
+	for(auto& front: fronts) {
+		const size_t mask = front->queue.size() - 1;
+		auto position = front->tail.load(std::memory_order_relaxed);
+		auto end = front->head.load(std::memory_order_acquire);
+		for(; position != end; ++position) {
+			global.InsertHandle(front->queue[position & mask]);
+		}
+		front->tail.store(position, std::memory_order_release);
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QHT_X86_DISPATCH 1
+#include <immintrin.h>
+#define QHT_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define QHT_TARGET_AVX2 __attribute__((target("avx2,bmi2,popcnt")))
+#define QHT_TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl,avx2,bmi2,popcnt")))
+#else
+#define QHT_X86_DISPATCH 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define QHT_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define QHT_ALWAYS_INLINE inline
+#endif
+
+/**
+ * Runtime selection of the instruction set of the hot kernels.
+ *
+ * The library is built for baseline x86-64, so that one binary runs on every host. The hot kernels that benefit
+ * from newer instructions (batch hashing, CRC32C, merge and diff scans, occupancy scan) are compiled in several
+ * variants with target attributes (baseline, AVX2, AVX-512), whatever the flags of the build, and the variant is
+ * picked from the features of the CPU the program runs on (cpuid, read once). A kernel body is written once,
+ * as a QHT_ALWAYS_INLINE function, and inlined into a wrapper per target. Other architectures use the baseline.
+ * Setting the environment variable QHT_CPU to "baseline" or "avx2" caps the level, e.g. to compare variants.
+ */
+
+enum CpuLevel { kCpuBaseline, kCpuAvx2, kCpuAvx512 };
+
+inline CpuLevel DetectCpuLevel() {
+	/** @returns the best level supported by the CPU, capped by QHT_CPU */
+	CpuLevel level = kCpuBaseline;
+#if QHT_X86_DISPATCH
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+		level = kCpuAvx2;
+	}
+	if(level == kCpuAvx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")
+		&& __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+		level = kCpuAvx512;
+	}
+#endif
+	auto cap = std::getenv("QHT_CPU");
+	if(cap != nullptr && std::strcmp(cap, "baseline") == 0) {
+		level = kCpuBaseline;
+	} else if(cap != nullptr && std::strcmp(cap, "avx2") == 0 && level > kCpuAvx2) {
+		level = kCpuAvx2;
+	}
+	return level;
+}
+
+inline CpuLevel GetCpuLevel() {
+	/** Level of the running CPU, detected on first use */
+	static const CpuLevel level = DetectCpuLevel();
+	return level;
+}
+
+inline bool CpuHasCrc32c() {
+	/** @returns true if the CRC32C instruction is available (SSE4.2), detected on first use */
+#if QHT_X86_DISPATCH
+	static const bool available = [] {
+		__builtin_cpu_init();
+		auto cap = std::getenv("QHT_CPU");
+		return __builtin_cpu_supports("sse4.2") && (cap == nullptr || std::strcmp(cap, "baseline") != 0);
+	}();
+	return available;
+#else
+	return false;
+#endif
+}
+
+inline const char* CpuLevelName(const CpuLevel level) {
+	static const char* names[] = {"baseline", "avx2", "avx512"};
+	return names[level];
+}
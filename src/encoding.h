@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Helpers for the binary formats of the filters (deltas, snapshots).
+ * Integers are written as LEB128 varints, words of the packed storage as little-endian 64-bit integers.
+ * Readers take a cursor and the end of the buffer, and return false instead of reading past the end.
+ *
+ * Words can also be compressed (PutCompressedWords), which pays off on sparse or low-entropy filters:
+ * they are grouped into runs of the same class, each run starting with a varint token (count << 2 | class).
+ *  - 0: `count` zero words, nothing follows
+ *  - 1: `count` words with all bits set, nothing follows
+ *  - 2: `count` words, stored as is (8 bytes each)
+ *  - 3: `count` sparse words with at most kSparseBits bits set, each stored as the number of bits set (1 byte)
+ *       followed by the positions of these bits, packed on 6 bits each
+ */
+
+/** Syntactic sugar for encoded buffers */
+typedef std::vector<uint8_t> ByteBuffer;
+
+inline void PutVarint(ByteBuffer& out, uint64_t value) {
+	while(value >= 0x80) {
+		out.push_back(uint8_t(value) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(uint8_t(value));
+}
+
+inline bool GetVarint(const uint8_t*& cursor, const uint8_t* end, uint64_t& value) {
+	value = 0;
+	for(size_t shift = 0; shift < 64 && cursor < end; shift += 7) {
+		auto byte = *cursor++;
+		value |= uint64_t(byte & 0x7f) << shift;
+		if(!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void PutWords(ByteBuffer& out, const uint64_t* words, const size_t n_words) {
+	auto size = out.size();
+	out.resize(size + n_words * 8);
+	auto bytes = out.data() + size;
+
+	for(size_t i = 0; i < n_words; ++i) {
+		for(size_t b = 0; b < 8; ++b) {
+			bytes[8 * i + b] = uint8_t(words[i] >> (8 * b));
+		}
+	}
+}
+
+inline bool GetWords(const uint8_t*& cursor, const uint8_t* end, uint64_t* words, const size_t n_words) {
+	if(size_t(end - cursor) / 8 < n_words) {
+		return false;
+	}
+
+	for(size_t i = 0; i < n_words; ++i) {
+		uint64_t word = 0;
+		for(size_t b = 0; b < 8; ++b) {
+			word |= uint64_t(cursor[8 * i + b]) << (8 * b);
+		}
+		words[i] = word;
+	}
+	cursor += 8 * n_words;
+
+	return true;
+}
+
+/** Words with at most this many bits set are stored as bit positions (1 + 6 bytes at most instead of 8) */
+const size_t kSparseBits = 8;
+
+enum WordClass : uint8_t { kZeroWords = 0, kFullWords = 1, kLiteralWords = 2, kSparseWords = 3 };
+
+inline WordClass ClassifyWord(const uint64_t word) {
+	if(word == 0) {
+		return kZeroWords;
+	}
+	if(word == ~uint64_t(0)) {
+		return kFullWords;
+	}
+	if(size_t(__builtin_popcountll(word)) <= kSparseBits) {
+		return kSparseWords;
+	}
+	return kLiteralWords;
+}
+
+inline void PutCompressedWords(ByteBuffer& out, const uint64_t* words, const size_t n_words) {
+	/**
+	 * Appends n_words words in the compressed format described above
+	 */
+	size_t begin = 0;
+	while(begin < n_words) {
+		auto word_class = ClassifyWord(words[begin]);
+		auto end = begin + 1;
+		while(end < n_words && ClassifyWord(words[end]) == word_class) {
+			++end;
+		}
+
+		PutVarint(out, (uint64_t(end - begin) << 2) | word_class);
+
+		if(word_class == kLiteralWords) {
+			PutWords(out, words + begin, end - begin);
+		} else if(word_class == kSparseWords) {
+			for(auto i = begin; i < end; ++i) {
+				auto word = words[i];
+				out.push_back(uint8_t(__builtin_popcountll(word)));
+
+				// Positions are packed 6 bits at a time, least significant bits first
+				uint32_t pending = 0;
+				size_t n_pending = 0;
+				while(word != 0) {
+					pending |= uint32_t(__builtin_ctzll(word)) << n_pending;
+					n_pending += 6;
+					word &= word - 1;
+
+					while(n_pending >= 8) {
+						out.push_back(uint8_t(pending));
+						pending >>= 8;
+						n_pending -= 8;
+					}
+				}
+				if(n_pending > 0) {
+					out.push_back(uint8_t(pending));
+				}
+			}
+		}
+
+		begin = end;
+	}
+}
+
+inline bool GetCompressedWords(const uint8_t*& cursor, const uint8_t* end, uint64_t* words, const size_t n_words) {
+	/**
+	 * Reads n_words words written by PutCompressedWords
+	 * @param words: output, or nullptr to only validate the input
+	 * @returns false if the input is malformed or does not hold exactly n_words words
+	 */
+	size_t position = 0;
+	while(position < n_words) {
+		uint64_t token;
+		if(!GetVarint(cursor, end, token)) {
+			return false;
+		}
+
+		auto count = token >> 2;
+		if(count > n_words - position) {
+			return false;
+		}
+
+		switch(token & 0b11) {
+		case kZeroWords:
+		case kFullWords:
+			if(words != nullptr) {
+				std::fill(words + position, words + position + count, (token & 0b11) == kZeroWords ? 0 : ~uint64_t(0));
+			}
+			break;
+		case kLiteralWords:
+			if(words != nullptr) {
+				if(!GetWords(cursor, end, words + position, count)) {
+					return false;
+				}
+			} else if(size_t(end - cursor) / 8 < count) {
+				return false;
+			} else {
+				cursor += 8 * count;
+			}
+			break;
+		default:
+			for(size_t i = 0; i < count; ++i) {
+				if(cursor == end || *cursor > kSparseBits) {
+					return false;
+				}
+				size_t n_bits = *cursor++;
+				size_t n_bytes = (6 * n_bits + 7) / 8;
+				if(size_t(end - cursor) < n_bytes) {
+					return false;
+				}
+
+				uint64_t word = 0;
+				uint64_t packed = 0;
+				for(size_t b = 0; b < n_bytes; ++b) {
+					packed |= uint64_t(cursor[b]) << (8 * b);
+				}
+				for(size_t b = 0; b < n_bits; ++b) {
+					word |= uint64_t(1) << ((packed >> (6 * b)) & 0x3f);
+				}
+				cursor += n_bytes;
+
+				if(words != nullptr) {
+					words[position + i] = word;
+				}
+			}
+			break;
+		}
+
+		position += count;
+	}
+
+	return true;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "qht.h"
+
+struct HotKeySet {
+	/**
+	 * Exact set of keys, as the full 64-bit Hash1 of each key (0 is stored as 1, 0 marking empty slots).
+	 * Open addressing by groups of 8 slots aligned on a cache line (a power of two of them), so that a probe reads
+	 * a single line: a key goes to an empty slot of its group, or replaces a random one if the group is full.
+	 * A few thousand keys (8 bytes each) stay in L1/L2.
+	 */
+	static const size_t kSlots = 8;
+
+	struct alignas(64) Group {
+		uint64_t slots[kSlots];
+	};
+
+	std::vector<Group> groups;
+	std::minstd_rand rng;
+
+	explicit HotKeySet(const size_t n_keys) : groups(Groups(n_keys), Group{}), rng() {}
+
+	static size_t Groups(const size_t n_keys) {
+		size_t n_groups = 1;
+		while(n_groups * kSlots < n_keys) {
+			n_groups *= 2;
+		}
+		return n_groups;
+	}
+
+	static uint64_t MemoryBits(const size_t n_keys) { return 8 * sizeof(Group) * Groups(n_keys); }
+
+	static uint64_t Id(const HashValue hash1) { return hash1 + (hash1 == 0); }
+
+	Group& GroupOf(const uint64_t id) {
+		// Other bits than those of the cell of the key in the filter (Hash1 modulo the number of cells)
+		return groups[hash_detail::Fold(id, hash_detail::kPrime5) & (groups.size() - 1)];
+	}
+
+	void Prefetch(const uint64_t id) { __builtin_prefetch(&GroupOf(id)); }
+
+	bool Contains(const uint64_t id) {
+		auto& group = GroupOf(id);
+		uint64_t found = 0;
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			found |= group.slots[slot] == id;
+		}
+		return found != 0;
+	}
+
+	void Insert(const uint64_t id) {
+		/** Inserts an id known to be absent */
+		auto& group = GroupOf(id);
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			if(group.slots[slot] == 0) {
+				group.slots[slot] = id;
+				return;
+			}
+		}
+		group.slots[rng() % kSlots] = id;
+	}
+
+	bool Remove(const uint64_t id) {
+		auto& group = GroupOf(id);
+		for(size_t slot = 0; slot < kSlots; ++slot) {
+			if(group.slots[slot] == id) {
+				group.slots[slot] = 0;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Clear() {
+		std::fill(groups.begin(), groups.end(), Group{});
+	}
+};
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>, class Filter = QHTFilter<T, HashPolicy>> class FrontCachedFilter {
+	/**
+	 * A filter (QHTFilter by default, or any filter with the handle operations, e.g. TwoChoiceQHTFilter) behind
+	 * a small exact set of hot keys (see HotKeySet). A key in the set is answered from it, without probing the cells
+	 * of the filter. A key that the filter detects as a duplicate is admitted into the set with probability 1/kAdmission:
+	 * the keys that cause most duplicates end up there, and cannot be lost to the evictions of the filter while they stay
+	 * there, while the rarer duplicates seldom evict them.
+	 *
+	 * Keys in the set no longer refresh the filter: once evicted from the set (by hotter keys of the same group),
+	 * a key is only detected if the filter still holds it. The set comes on top of the memory of the filter.
+	 */
+	static const uint32_t kAdmission = 8; // 1 detection out of kAdmission admits the key
+
+	HotKeySet hot_keys;
+	Filter filter;
+
+public:
+	FrontCachedFilter(const uint64_t memory_size, const size_t n_buckets, const size_t fingerprint_size, const size_t n_hot_keys = 4096);
+
+	bool Lookup(const T& e) { return LookupHandle(Filter::Prehash(e)); }
+	bool Insert(const T& e) { return InsertHandle(Filter::Prehash(e)); }
+	bool Stream(const T& e) { return StreamHandle(Filter::Prehash(e)); }
+	bool Delete(const T& e) { return DeleteHandle(Filter::Prehash(e)); }
+	void Reset();
+
+	// Same operations on the bytes of a key (see KeyBytes) or its hashes (see QHTFilter::Prehash)
+	bool Lookup(const std::string_view bytes) { return LookupHandle(Filter::Prehash(bytes)); }
+	bool Stream(const std::string_view bytes) { return StreamHandle(Filter::Prehash(bytes)); }
+	template <class C, IfCString<C> = 0> bool Lookup(const C* bytes) { return Lookup(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	bool Lookup(const void* data, const size_t size) { return LookupHandle(Filter::Prehash(data, size)); }
+	bool Stream(const void* data, const size_t size) { return StreamHandle(Filter::Prehash(data, size)); }
+	bool LookupHandle(const KeyHandle& handle);
+	bool InsertHandle(const KeyHandle& handle) { return filter.InsertHandle(handle); }
+	bool StreamHandle(const KeyHandle& handle);
+	bool DeleteHandle(const KeyHandle& handle);
+
+	void LookupBatch(const T* keys, const size_t n, bool* results) {
+		ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return LookupHandle(handle); });
+	}
+	void StreamBatch(const T* keys, const size_t n, bool* results) {
+		ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return StreamHandle(handle); });
+	}
+
+	Filter& Back() { return filter; }
+	const Filter& Back() const { return filter; }
+
+private:
+	template <class Operation> void ForEachInBatch(const T* keys, const size_t n, bool* results, Operation operation);
+};
+
+template <class T, class HashPolicy, class Filter> FrontCachedFilter<T, HashPolicy, Filter>::FrontCachedFilter(
+	const uint64_t memory_size,
+	const size_t n_buckets,
+	const size_t fingerprint_size,
+	const size_t n_hot_keys
+) : hot_keys(n_hot_keys), filter(memory_size, n_buckets, fingerprint_size) {
+	/**
+	 * @param memory_size, n_buckets, fingerprint_size: parameters of the filter
+	 * @param n_hot_keys: capacity of the set of hot keys, 4096 keys take 32 KB (see HotKeySet::MemoryBits)
+	 */
+}
+
+template <class T, class HashPolicy, class Filter> template <class Operation> void FrontCachedFilter<T, HashPolicy, Filter>::ForEachInBatch(
+	const T* keys,
+	const size_t n,
+	bool* results,
+	Operation operation
+) {
+	/**
+	 * Runs operation(handle) on the keys, kBatchSize at a time: the keys of a batch are hashed together (see HashBatch),
+	 * then the groups of the set they map to are prefetched
+	 */
+	KeyHandle handles[kBatchSize];
+
+	for(size_t begin = 0; begin < n; begin += kBatchSize) {
+		const size_t count = std::min(kBatchSize, n - begin);
+		HashBatch<HashPolicy>(keys + begin, count, handles);
+
+		for(size_t i = 0; i < count; ++i) {
+			hot_keys.Prefetch(HotKeySet::Id(handles[i].hash1));
+		}
+		for(size_t i = 0; i < count; ++i) {
+			results[begin + i] = operation(handles[i]);
+		}
+	}
+}
+
+template <class T, class HashPolicy, class Filter> bool FrontCachedFilter<T, HashPolicy, Filter>::LookupHandle(const KeyHandle& handle) {
+	return hot_keys.Contains(HotKeySet::Id(handle.hash1)) || filter.LookupHandle(handle);
+}
+
+template <class T, class HashPolicy, class Filter> bool FrontCachedFilter<T, HashPolicy, Filter>::StreamHandle(const KeyHandle& handle) {
+	/** @returns true if e was already in the set or in the filter, false otherwise (e is then inserted in the filter) */
+	auto id = HotKeySet::Id(handle.hash1);
+	if(hot_keys.Contains(id)) {
+		return true;
+	}
+
+	auto detected = filter.StreamHandle(handle);
+	if(detected && hot_keys.rng() % kAdmission == 0) {
+		hot_keys.Insert(id);
+	}
+	return detected;
+}
+
+template <class T, class HashPolicy, class Filter> bool FrontCachedFilter<T, HashPolicy, Filter>::DeleteHandle(const KeyHandle& handle) {
+	auto in_set = hot_keys.Remove(HotKeySet::Id(handle.hash1));
+	return filter.DeleteHandle(handle) || in_set;
+}
+
+template <class T, class HashPolicy, class Filter> void FrontCachedFilter<T, HashPolicy, Filter>::Reset() {
+	hot_keys.Clear();
+	filter.Reset();
+}
@@ -1,6 +1,28 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#define QHT_IOVEC 1
+#else
+#define QHT_IOVEC 0
+#endif
+
+#include "cpu.h"
 
 #include "xxhash.h"
 #include "xxhash.hpp"
@@ -8,21 +30,494 @@
 /** Syntactic sugar for hash values */
 typedef xxh::hash_t<64> HashValue;
 
-template<class T> HashValue Hash1(T t) {
-	/** Computes a hash for an element of type T 
+/**
+ * Contiguous bytes of a key, e.g. a slice of a network buffer: they hash as the key they are the image of
+ * (the characters of a string, the elements of a vector, array or initializer_list), without building the key
+ */
+struct KeyBytes {
+	const void* data;
+	size_t size;
+};
+
+/**
+ * Enables an overload taking a C string (const C*) for C = char only: unlike a `const char*` parameter,
+ * it is not a candidate for the literal 0, which stays an integer key
+ */
+template <class C> using IfCString = typename std::enable_if<std::is_same<C, char>::value, int>::type;
+
+/**
+ * A key given as several fragments, e.g. the fields of a composite key: it hashes as the concatenation of the
+ * bytes of its parts, without building it (see PolicyHashParts)
+ */
+struct KeyParts {
+	const KeyBytes* parts;
+	size_t count;
+};
+
+/**
+ * Both hashes of a key, computed once (see QHTFilter::Prehash) and reused to probe any number of filters:
+ * they hash as the key they were computed from
+ */
+struct KeyHandle {
+	HashValue hash1;
+	HashValue hash2;
+};
+
+/**
+ * Hash policies: the hash functions a filter is built with (second template parameter of the filters).
+ *
+ * A policy hashes the bytes of a key with a seed: `static HashValue Hash(const KeyBytes& key, const uint64_t seed)`,
+ * Hash1 of a key being its hash with kHash1Seed and Hash2 with kHash2Seed. A policy can instead compute both hashes
+ * with a single mix: `static KeyHandle Hashes(const KeyBytes& key)`, the filters then hash each key once (see PolicyKey).
+ * Keys are turned into bytes by AsBytes, so that a key and its bytes (KeyBytes) hash the same with every policy.
+ * A policy that hashes incrementally can also hash a key in parts: `static KeyHandle HashParts(const KeyParts& key)`,
+ * the other policies hash a copy of the concatenated parts.
+ *
+ *  - XXHashPolicy: xxhash64, the default, also used by the Hash1 and Hash2 functions
+ *  - ShortKeyHashPolicy: XXH3-style, a couple of multiplications for keys of up to 16 bytes, 16-byte blocks above
+ *  - Crc32cHashPolicy: CRC32C instructions (SSE4.2, selected at runtime, or ARMv8 CRC), a software loop otherwise,
+ *    for fixed-width keys
+ *  - MixHashPolicy: murmur3 finalizer for keys of up to 8 bytes (integer ids), wyhash-style multiply-fold above
+ *  - FixedWidthHashPolicy: the MixHashPolicy mixer, once for both hashes. The default for keys whose bytes are their value
+ *    (integers, std::array of bytes, structs without padding), see DefaultHashPolicy
+ *
+ * A policy can also have an id (`static const uint8_t kId`), see PolicyId.
+ *
+ * The policies other than XXHashPolicy read words in native byte order: hashes, hence snapshots, differ between
+ * little and big endian machines.
+ */
+
+const uint64_t kHash1Seed = 0;
+const uint64_t kHash2Seed = 0x1234567890abcdef;
+
+template<class T> KeyBytes AsBytes(const T& t) {
+	/**
+	 * Bytes of a key: the object itself for types whose equal values have equal bytes (integers, structs without padding),
+	 * as xxhash would hash them. Padding bytes are indeterminate, and floats have several representations of 0,
+	 * so such keys would be missed: they are rejected.
+	 */
+	static_assert(std::has_unique_object_representations_v<T>, "Keys are containers of contiguous elements or have unique object representations");
+	return KeyBytes{&t, sizeof(T)};
+}
+
+template<class T> KeyBytes AsBytes(const std::basic_string<T>& t) {
+	return KeyBytes{t.data(), t.size() * sizeof(T)};
+}
+
+template<class T> KeyBytes AsBytes(const std::basic_string_view<T>& t) {
+	return KeyBytes{t.data(), t.size() * sizeof(T)};
+}
+
+template<class T> KeyBytes AsBytes(const std::vector<T>& t) {
+	return KeyBytes{t.data(), t.size() * sizeof(T)};
+}
+
+template<class T, size_t N> KeyBytes AsBytes(const std::array<T, N>& t) {
+	return KeyBytes{t.data(), N * sizeof(T)};
+}
+
+template<class T> KeyBytes AsBytes(const std::initializer_list<T>& t) {
+	return KeyBytes{t.begin(), t.size() * sizeof(T)};
+}
+
+inline KeyBytes AsBytes(const KeyBytes& key) {
+	return key;
+}
+
+template<class Policy, class = void> struct HashesInOneMix : std::false_type {};
+template<class Policy> struct HashesInOneMix<Policy, std::void_t<decltype(Policy::Hashes(std::declval<const KeyBytes&>()))>> : std::true_type {};
+
+template<class Policy, class K> HashValue PolicyHash1(const K& e) {
+	/** Hash1 of a key, its bytes or its handle with a hash policy */
+	if constexpr(HashesInOneMix<Policy>::value) {
+		return Policy::Hashes(AsBytes(e)).hash1;
+	} else {
+		return Policy::Hash(AsBytes(e), kHash1Seed);
+	}
+}
+
+template<class Policy> HashValue PolicyHash1(const KeyHandle& key) {
+	return key.hash1;
+}
+
+template<class Policy, class K> HashValue PolicyHash2(const K& e) {
+	if constexpr(HashesInOneMix<Policy>::value) {
+		return Policy::Hashes(AsBytes(e)).hash2;
+	} else {
+		return Policy::Hash(AsBytes(e), kHash2Seed);
+	}
+}
+
+template<class Policy> HashValue PolicyHash2(const KeyHandle& key) {
+	return key.hash2;
+}
+
+template<class Policy, class K> auto PolicyKey(const K& e) -> std::conditional_t<HashesInOneMix<Policy>::value, KeyHandle, const K&> {
+	/**
+	 * What the operations of a filter hash: the handle of the key if the policy computes both hashes in one mix,
+	 * the key itself otherwise (Hash1 and Hash2 are then computed separately, e.g. to time them separately)
+	 */
+	if constexpr(HashesInOneMix<Policy>::value) {
+		return Policy::Hashes(AsBytes(e));
+	} else {
+		return e;
+	}
+}
+
+template<class Policy> const KeyHandle& PolicyKey(const KeyHandle& key) {
+	return key;
+}
+
+/**
+ * Identifier of a policy (`static const uint8_t kId`, nonzero), written in the headers of snapshots and deltas so that
+ * a filter built with another policy rejects them. Policies without one have the id 0.
+ */
+template<class Policy, class = void> struct PolicyId : std::integral_constant<uint8_t, 0> {};
+template<class Policy> struct PolicyId<Policy, std::void_t<decltype(Policy::kId)>> : std::integral_constant<uint8_t, Policy::kId> {};
+
+template<class Policy, class = void> struct HashesInParts : std::false_type {};
+template<class Policy> struct HashesInParts<Policy, std::void_t<decltype(Policy::HashParts(std::declval<const KeyParts&>()))>> : std::true_type {};
+
+/** Parts of up to this many bytes in all are concatenated on the stack by PolicyHashParts, longer ones on the heap */
+const size_t kPartsStackBytes = 256;
+
+inline size_t PartsSize(const KeyParts& key) {
+	size_t size = 0;
+	for(size_t i = 0; i < key.count; ++i) {
+		size += key.parts[i].size;
+	}
+	return size;
+}
+
+inline void GatherParts(const KeyParts& key, uint8_t* buffer) {
+	/** Concatenates the parts of key into buffer, of PartsSize(key) bytes */
+	for(size_t i = 0; i < key.count; ++i) {
+		if(key.parts[i].size > 0) {
+			std::memcpy(buffer, key.parts[i].data, key.parts[i].size);
+			buffer += key.parts[i].size;
+		}
+	}
+}
+
+template<class Policy> KeyHandle PolicyHashParts(const KeyParts& key) {
+	/** @returns the hashes of the concatenation of the parts of key, as QHTFilter::Prehash would compute them */
+	if constexpr(HashesInParts<Policy>::value) {
+		return Policy::HashParts(key);
+	} else {
+		const size_t size = PartsSize(key);
+		uint8_t stack[kPartsStackBytes] = {};
+		std::vector<uint8_t> heap;
+		uint8_t* buffer = stack;
+		if(size > sizeof(stack)) {
+			heap.resize(size);
+			buffer = heap.data();
+		}
+		GatherParts(key, buffer);
+
+		const KeyBytes concatenated{buffer, size};
+		const auto& bytes = PolicyKey<Policy>(concatenated);
+		return KeyHandle{PolicyHash1<Policy>(bytes), PolicyHash2<Policy>(bytes)};
+	}
+}
+
+#if QHT_IOVEC
+/** Byte ranges of up to this many parts are described on the stack by PolicyHashParts, longer lists on the heap */
+const size_t kIovecStackParts = 8;
+
+template<class Policy> KeyHandle PolicyHashParts(const iovec* ranges, const size_t count) {
+	/**
+	 * Hashes of the concatenation of count byte ranges, e.g. a key split across receive buffers:
+	 * the ranges are described as KeyBytes, the bytes themselves are not copied
+	 */
+	KeyBytes stack[kIovecStackParts] = {};
+	std::vector<KeyBytes> heap;
+	KeyBytes* parts = stack;
+	if(count > kIovecStackParts) {
+		heap.resize(count);
+		parts = heap.data();
+	}
+	for(size_t i = 0; i < count; ++i) {
+		parts[i] = KeyBytes{ranges[i].iov_base, ranges[i].iov_len};
+	}
+	return PolicyHashParts<Policy>(KeyParts{parts, count});
+}
+#endif
+
+template<class T> KeyBytes FieldBytes(const T& field) {
+	/** Bytes of a field of a composite key: see AsBytes, C strings being their characters */
+	return AsBytes(field);
+}
+
+inline KeyBytes FieldBytes(const char* field) {
+	return KeyBytes{field, std::strlen(field)};
+}
+
+struct XXHashPolicy {
+	static const uint8_t kId = 1;
+
+	static HashValue Hash(const KeyBytes& key, const uint64_t seed) {
+		return xxh::xxhash<64>(key.data, key.size, seed);
+	}
+
+	static KeyHandle HashParts(const KeyParts& key) {
+		/**
+		 * Both hashes in one pass over the parts, with the streaming API of xxhash (same hashes as one buffer).
+		 * Keys of up to 32 bytes (one stripe) would be copied into the states anyway, they are gathered and hashed
+		 * in one call instead (the streaming digest of the vendored xxhash is also wrong for exactly 32 bytes).
+		 */
+		const size_t size = PartsSize(key);
+		if(size <= 32) {
+			uint8_t buffer[32] = {};
+			GatherParts(key, buffer);
+			return KeyHandle{Hash(KeyBytes{buffer, size}, kHash1Seed), Hash(KeyBytes{buffer, size}, kHash2Seed)};
+		}
+
+		xxh::hash_state_t<64> state1(kHash1Seed), state2(kHash2Seed);
+		for(size_t i = 0; i < key.count; ++i) {
+			if(key.parts[i].size > 0) {
+				state1.update(key.parts[i].data, key.parts[i].size);
+				state2.update(key.parts[i].data, key.parts[i].size);
+			}
+		}
+		return KeyHandle{state1.digest(), state2.digest()};
+	}
+};
+
+template<class T> HashValue Hash1(const T& t) {
+	/** Computes a hash for an element of type T, its bytes (KeyBytes) or its handle (KeyHandle), with xxhash64
 	 *   @param t: object to be hashed
 	 *   @returns A HashValue which is likely to be different for different inputs
 	 */
-	return xxh::xxhash<64>(t);
+	return PolicyHash1<XXHashPolicy>(t);
 }
 
-template<class T> HashValue Hash2(T t) {
-	/** Computes a hash for an element of type T
+template<class T> HashValue Hash2(const T& t) {
+	/** Computes a hash for an element of type T, its bytes (KeyBytes) or its handle (KeyHandle), with xxhash64
 	 * @param t: object to be hashed
 	 * @returns A HashValue (more or less) independent of Hash1(t)
 	 */
-	size_t seed = 0x1234567890abcdef;
+	return PolicyHash2<XXHashPolicy>(t);
+}
+
+namespace hash_detail {
+
+__extension__ typedef unsigned __int128 uint128_t;
 
-	return xxh::xxhash<64>(t, seed);
+const uint64_t kPrime1 = 0x9e3779b185ebca87;
+const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4f;
+const uint64_t kPrime3 = 0x165667b19e3779f9;
+const uint64_t kPrime4 = 0xa0761d6478bd642f;
+const uint64_t kPrime5 = 0xe7037ed1a0b428db;
+
+inline uint64_t Load64(const uint8_t* p) {
+	uint64_t word;
+	std::memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+inline uint32_t Load32(const uint8_t* p) {
+	uint32_t word;
+	std::memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+inline uint64_t LoadTail(const uint8_t* p, const size_t size) {
+	/** @returns the size < 8 bytes at p, zero-extended */
+	uint64_t word = 0;
+	std::memcpy(&word, p, size);
+	return word;
+}
+
+inline uint64_t Fold(const uint64_t a, const uint64_t b) {
+	/** Full 64x64 bit product, folded: the high half XOR-ed into the low half */
+	auto product = uint128_t(a) * b;
+	return uint64_t(product) ^ uint64_t(product >> 64);
+}
+
+inline uint64_t Fmix64(uint64_t h) {
+	/** murmur3 finalizer: a bijection in which every input bit affects every output bit */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccd;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53;
+	h ^= h >> 33;
+	return h;
 }
 
+inline uint64_t Avalanche(uint64_t h) {
+	/** XXH3 avalanche */
+	h ^= h >> 37;
+	h *= 0x165667919e3779f9;
+	h ^= h >> 32;
+	return h;
+}
+
+struct Crc32cSoftware {
+	static uint32_t Step(uint32_t crc, const uint64_t word) {
+		/** Bit by bit CRC32C (Castagnoli, reflected) of a word, for CPUs without a CRC instruction */
+		crc ^= uint32_t(word);
+		for(int i = 0; i < 32; ++i) {
+			crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+		}
+		crc ^= uint32_t(word >> 32);
+		for(int i = 0; i < 32; ++i) {
+			crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+		}
+		return crc;
+	}
+};
+
+#if QHT_X86_DISPATCH
+struct Crc32cSse42 {
+	QHT_TARGET_SSE42 static uint32_t Step(const uint32_t crc, const uint64_t word) { return uint32_t(_mm_crc32_u64(crc, word)); }
+};
+#elif defined(__ARM_FEATURE_CRC32)
+struct Crc32cArm {
+	static uint32_t Step(const uint32_t crc, const uint64_t word) { return __crc32cd(crc, word); }
+};
+#endif
+
+template<class Crc> QHT_ALWAYS_INLINE uint64_t Crc32cBytes(const uint8_t* p, const size_t size, const uint64_t seed) {
+	/**
+	 * Two CRC32C chains over the 8-byte words of the key, the second one on the words multiplied by an odd
+	 * constant (CRC is linear, the product is not), concatenated and finalized
+	 */
+	uint32_t low = uint32_t(seed), high = uint32_t(seed >> 32) ^ uint32_t(size);
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8) {
+		auto word = Load64(p + i);
+		low = Crc::Step(low, word);
+		high = Crc::Step(high, word * kPrime1);
+	}
+	if(i < size) {
+		auto word = LoadTail(p + i, size - i);
+		low = Crc::Step(low, word);
+		high = Crc::Step(high, word * kPrime1);
+	}
+
+	return Fmix64(((uint64_t(high) << 32) | low) ^ seed);
+}
+
+#if QHT_X86_DISPATCH
+QHT_TARGET_SSE42 inline uint64_t Crc32cBytesSse42(const uint8_t* p, const size_t size, const uint64_t seed) {
+	return Crc32cBytes<Crc32cSse42>(p, size, seed);
+}
+#endif
+
+inline uint64_t MixBytes(const uint8_t* p, const size_t size, const uint64_t seed) {
+	/**
+	 * Keys of up to 8 bytes (integer ids) go through the murmur3 finalizer, a bijection of the key for a given
+	 * seed and size: distinct ids never collide on a whole hash. Keys of 9 to 16 bytes are two (overlapping) words
+	 * mixed by two wyhash-style multiplications, longer keys are folded 8 bytes at a time.
+	 * When size is a constant, the branches and the loop compile away.
+	 */
+	if(size <= 8) {
+		auto word = size == 8 ? Load64(p) : LoadTail(p, size);
+		return Fmix64(word ^ Fmix64(seed ^ (size * kPrime2)));
+	}
+	if(size <= 16) {
+		return Fold(kPrime1 ^ size, Fold(Load64(p) ^ kPrime4, Load64(p + size - 8) ^ kPrime5 ^ seed));
+	}
+
+	uint64_t h = seed ^ kPrime4 ^ (size * kPrime2);
+	size_t i = 0;
+	for(; i + 8 < size; i += 8) {
+		h = Fold(h ^ Load64(p + i), kPrime5);
+	}
+	h = Fold(h ^ Load64(p + size - 8), kPrime1);
+
+	return Fmix64(h);
+}
+
+}
+
+struct ShortKeyHashPolicy {
+	static const uint8_t kId = 2;
+
+	static HashValue Hash(const KeyBytes& key, const uint64_t seed) {
+		/**
+		 * Follows the short-input paths of XXH3 (0, 1-3, 4-8, 9-16 bytes), with fixed secrets;
+		 * longer keys are mixed 16 bytes at a time, the last block overlapping the previous one
+		 */
+		using namespace hash_detail;
+		auto p = static_cast<const uint8_t*>(key.data);
+		const uint64_t size = key.size;
+
+		if(size > 16) {
+			uint64_t acc = size * kPrime1 + seed;
+			uint64_t secret = kPrime4;
+			for(size_t i = 0; i + 16 < size; i += 16, secret += kPrime3) {
+				acc += Fold(Load64(p + i) ^ (secret + seed), Load64(p + i + 8) ^ (secret * kPrime2 - seed));
+			}
+			acc += Fold(Load64(p + size - 16) ^ (kPrime5 + seed), Load64(p + size - 8) ^ (kPrime2 - seed));
+			return Avalanche(acc);
+		}
+		if(size > 8) {
+			uint64_t low = Load64(p) ^ (kPrime4 + seed);
+			uint64_t high = Load64(p + size - 8) ^ (kPrime5 - seed);
+			return Avalanche(size + __builtin_bswap64(low) + high + Fold(low, high));
+		}
+		if(size >= 4) {
+			uint64_t input = Load32(p + size - 4) + (uint64_t(Load32(p)) << 32);
+			uint64_t keyed = input ^ (kPrime4 - seed);
+			// rrmxmx
+			keyed ^= ((keyed << 49) | (keyed >> 15)) ^ ((keyed << 24) | (keyed >> 40));
+			keyed *= 0x9fb21c651e98df25;
+			keyed ^= (keyed >> 35) + size;
+			keyed *= 0x9fb21c651e98df25;
+			return keyed ^ (keyed >> 28);
+		}
+		if(size > 0) {
+			uint32_t combined = (uint32_t(p[0]) << 16) | (uint32_t(p[size >> 1]) << 24) | uint32_t(p[size - 1]) | (uint32_t(size) << 8);
+			return Fmix64(combined ^ (kPrime5 + seed));
+		}
+		return Fmix64(seed ^ kPrime4);
+	}
+};
+
+struct Crc32cHashPolicy {
+	static const uint8_t kId = 3;
+
+	static HashValue Hash(const KeyBytes& key, const uint64_t seed) {
+		/** See hash_detail::Crc32cBytes. Meant for keys of a fixed, small width: one CRC instruction per chain and per word. */
+		using namespace hash_detail;
+		auto p = static_cast<const uint8_t*>(key.data);
+#if QHT_X86_DISPATCH
+		if(CpuHasCrc32c()) {
+			return Crc32cBytesSse42(p, key.size, seed);
+		}
+		return Crc32cBytes<Crc32cSoftware>(p, key.size, seed);
+#elif defined(__ARM_FEATURE_CRC32)
+		return Crc32cBytes<Crc32cArm>(p, key.size, seed);
+#else
+		return Crc32cBytes<Crc32cSoftware>(p, key.size, seed);
+#endif
+	}
+};
+
+struct MixHashPolicy {
+	static const uint8_t kId = 4;
+
+	static HashValue Hash(const KeyBytes& key, const uint64_t seed) {
+		return hash_detail::MixBytes(static_cast<const uint8_t*>(key.data), key.size, seed);
+	}
+};
+
+struct FixedWidthHashPolicy {
+	static const uint8_t kId = 5;
+
+	static KeyHandle Hashes(const KeyBytes& key) {
+		/**
+		 * One MixBytes for both hashes: Hash2 is a second finalizer of Hash1 (see Split), so that no bit of a fingerprint
+		 * (low bits of Hash2) is a bit of the address, whatever the number of cells (RQHTFilter takes addresses and
+		 * quotients from up to all the bits of Hash1)
+		 */
+		return Split(hash_detail::MixBytes(static_cast<const uint8_t*>(key.data), key.size, kHash1Seed));
+	}
+
+	static KeyHandle Split(const HashValue hash) {
+		return KeyHandle{hash, hash_detail::Fmix64(hash ^ hash_detail::kPrime3)};
+	}
+};
+
+template<class T> using DefaultHashPolicy = std::conditional_t<std::has_unique_object_representations_v<T>, FixedWidthHashPolicy, XXHashPolicy>;
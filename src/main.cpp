@@ -1,7 +1,10 @@
 //#include <cstdlib>
+#include <cassert>
 #include <iostream>
 #include "qht.h"
 #include "qqhtd.h"
+#include "rqht.h"
+#include "twochoice.h"
 //#include "xxhash.h"
 
 int main() {
@@ -16,6 +19,12 @@ int main() {
 	std::cout << filter1.Lookup("42") << std::endl;
 	std::cout << filter1.Lookup("43") << std::endl;
 
+    // Merging two filters with the same parameters, e.g. built on two different nodes
+	auto filter1b = QHTFilter<std::basic_string<char>>(65000, 1, 1);
+	filter1b.Stream("44");
+	filter1.Merge(filter1b);
+	std::cout << filter1.Lookup("44") << std::endl;
+
 // vector<T> elements
 	auto filter2 = QQHTDFilter<std::vector<int>>(65000, 2, 1);
 	
@@ -40,6 +49,40 @@ int main() {
     filter4.Lookup(e4);
     filter4.Delete(e4);
 
+// Resizable filter: 3 quotient bits per bucket, so it can be doubled up to 3 times
+    auto filter5 = RQHTFilter<std::basic_string<char>>(65000, 2, 4, 3);
+
+    filter5.Stream("42");
+    filter5.Grow();  // Doubles the number of cells, "42" is still detected
+    std::cout << filter5.Lookup("42") << std::endl;
+
+    filter5.StartShrink(16);  // Each following operation migrates 16 pairs of cells
+    filter5.Stream("43");
+
+    // Starting a resize while another is pending finishes the pending one first: no key is lost
+    for(auto resize: {0, 1}) {
+        auto filter5b = RQHTFilter<std::basic_string<char>>(1 << 16, 3, 8, 4);
+        for(int i = 0; i < 100; ++i) {
+            filter5b.Insert(std::to_string(i));
+        }
+        filter5b.StartGrow(0);
+        if(resize == 0) {
+            filter5b.StartGrow(0);   // grow then grow
+        } else {
+            filter5b.StartShrink(0); // grow then shrink
+        }
+        filter5b.Migrate(1 << 30);
+        for(int i = 0; i < 100; ++i) {
+            assert(filter5b.Lookup(std::to_string(i)));
+        }
+    }
+
+// Two candidate cells per key: fewer false negatives at the same memory
+    auto filter6 = TwoChoiceQHTFilter<std::basic_string<char>>(65000, 2, 4);
+
+    filter6.Stream("42");
+    std::cout << filter6.Lookup("42") << std::endl;
+
     return 0;
 }
 
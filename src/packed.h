@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "cpu.h"
+
+/**
+ * Packed bit storage shared by the filters.
+ *
+ * Bits are stored in sequence in 64-bit words, most significant bit first:
+ * bit i of the array is bit (63 - i % 64) of word i / 64.
+ * A field of `width` bits can therefore straddle two consecutive words.
+ *
+ * The scans over whole storages (WordsNeedMerge, SelectFindBlockToMerge, FindMismatch, ContainsWord, FieldScanner) have AVX2 and AVX-512 variants,
+ * selected at runtime (see cpu.h).
+ */
+
+/** Syntactic sugar for the packed storage of a filter */
+typedef std::vector<uint64_t> PackedBits;
+
+inline size_t PackedWords(const size_t n_bits) {
+	/** @returns the number of words needed to store n_bits bits */
+	return (n_bits + 63) / 64;
+}
+
+inline uint64_t ReadBits(const uint64_t* words, const size_t offset, const size_t width) {
+	/**
+	 * Reads a field of bits, most significant bit first
+	 * @param words: packed storage
+	 * @param offset: index of the first bit of the field
+	 * @param width: number of bits of the field, in 1..63
+	 * @returns the value of the field
+	 */
+	auto index = offset / 64;
+	auto shift = offset % 64;
+
+	uint64_t value = words[index] << shift;
+	if(shift + width > 64) {
+		value |= words[index + 1] >> (64 - shift);
+	}
+
+	return value >> (64 - width);
+}
+
+inline void WriteBits(uint64_t* words, const size_t offset, const size_t width, const uint64_t value) {
+	/**
+	 * Writes a field of bits, most significant bit first
+	 * @param words: packed storage
+	 * @param offset: index of the first bit of the field
+	 * @param width: number of bits of the field, in 1..63
+	 * @param value: value of the field, lower than 2^width
+	 */
+	auto index = offset / 64;
+	auto shift = offset % 64;
+
+	const uint64_t mask = ~uint64_t(0) << (64 - width);
+	const uint64_t aligned = value << (64 - width);
+
+	words[index] = (words[index] & ~(mask >> shift)) | (aligned >> shift);
+	if(shift + width > 64) {
+		words[index + 1] = (words[index + 1] & ~(mask << (64 - shift))) | (aligned << (64 - shift));
+	}
+}
+
+inline uint64_t ReadBitsRelaxed(const uint64_t* words, const size_t offset, const size_t width) {
+	/**
+	 * ReadBits for storage written concurrently: each word is read atomically (relaxed order),
+	 * a field that straddles two words may mix two writes
+	 */
+	auto index = offset / 64;
+	auto shift = offset % 64;
+
+	uint64_t value = __atomic_load_n(&words[index], __ATOMIC_RELAXED) << shift;
+	if(shift + width > 64) {
+		value |= __atomic_load_n(&words[index + 1], __ATOMIC_RELAXED) >> (64 - shift);
+	}
+
+	return value >> (64 - width);
+}
+
+inline void UpdateWordRelaxed(uint64_t* word, const uint64_t mask, const uint64_t bits) {
+	/** Atomically replaces the bits of *word selected by mask, leaving the other bits as concurrent writers left them */
+	uint64_t expected = __atomic_load_n(word, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(word, &expected, (expected & ~mask) | (bits & mask), true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+inline void WriteBitsRelaxed(uint64_t* words, const size_t offset, const size_t width, const uint64_t value) {
+	/**
+	 * WriteBits for storage written concurrently: fields sharing a word with this one are never overwritten,
+	 * but concurrent writes to the same field that straddles two words may leave one half of each
+	 */
+	auto index = offset / 64;
+	auto shift = offset % 64;
+
+	const uint64_t mask = ~uint64_t(0) << (64 - width);
+	const uint64_t aligned = value << (64 - width);
+
+	UpdateWordRelaxed(&words[index], mask >> shift, aligned >> shift);
+	if(shift + width > 64) {
+		UpdateWordRelaxed(&words[index + 1], mask << (64 - shift), aligned << (64 - shift));
+	}
+}
+
+namespace packed_detail {
+
+QHT_ALWAYS_INLINE bool WordsNeedMergeKernel(const uint64_t* words, const uint64_t* other, const size_t n_words) {
+	uint64_t non_zero = 0;
+	uint64_t difference = 0;
+
+	for(size_t i = 0; i < n_words; ++i) {
+		non_zero |= other[i];
+		difference |= words[i] ^ other[i];
+	}
+
+	return non_zero != 0 && difference != 0;
+}
+
+QHT_ALWAYS_INLINE size_t FindBlockToMergeKernel(const uint64_t* words, const uint64_t* other, const size_t n_words,
+	const size_t block_words, size_t block, const size_t end_block) {
+	for(; block < end_block; ++block) {
+		auto first_word = block * block_words;
+		if(WordsNeedMergeKernel(words + first_word, other + first_word, std::min(n_words, first_word + block_words) - first_word)) {
+			break;
+		}
+	}
+	return block;
+}
+
+inline size_t FindBlockToMergeBaseline(const uint64_t* words, const uint64_t* other, const size_t n_words,
+	const size_t block_words, const size_t block, const size_t end_block) {
+	return FindBlockToMergeKernel(words, other, n_words, block_words, block, end_block);
+}
+
+QHT_ALWAYS_INLINE size_t FindMismatchKernel(const uint64_t* words, const uint64_t* other, size_t begin, const size_t end) {
+	while(begin + 16 <= end) {
+		uint64_t difference = 0;
+		for(size_t i = 0; i < 16; ++i) {
+			difference |= words[begin + i] ^ other[begin + i];
+		}
+		if(difference != 0) {
+			break;
+		}
+		begin += 16;
+	}
+
+	while(begin < end && words[begin] == other[begin]) {
+		++begin;
+	}
+
+	return begin;
+}
+
+QHT_ALWAYS_INLINE bool ContainsWordKernel(const uint64_t* words, const size_t n_words, const uint64_t word) {
+	uint64_t found = 0;
+	for(size_t i = 0; i < n_words; ++i) {
+		found |= words[i] == word;
+	}
+	return found != 0;
+}
+
+#if QHT_X86_DISPATCH
+
+QHT_TARGET_AVX2 inline bool WordsNeedMergeAvx2(const uint64_t* words, const uint64_t* other, const size_t n_words) {
+	return WordsNeedMergeKernel(words, other, n_words);
+}
+
+QHT_TARGET_AVX512 inline bool WordsNeedMergeAvx512(const uint64_t* words, const uint64_t* other, const size_t n_words) {
+	return WordsNeedMergeKernel(words, other, n_words);
+}
+
+QHT_TARGET_AVX2 inline size_t FindBlockToMergeAvx2(const uint64_t* words, const uint64_t* other, const size_t n_words,
+	const size_t block_words, const size_t block, const size_t end_block) {
+	return FindBlockToMergeKernel(words, other, n_words, block_words, block, end_block);
+}
+
+QHT_TARGET_AVX512 inline size_t FindBlockToMergeAvx512(const uint64_t* words, const uint64_t* other, const size_t n_words,
+	const size_t block_words, const size_t block, const size_t end_block) {
+	return FindBlockToMergeKernel(words, other, n_words, block_words, block, end_block);
+}
+
+QHT_TARGET_AVX2 inline size_t FindMismatchAvx2(const uint64_t* words, const uint64_t* other, const size_t begin, const size_t end) {
+	return FindMismatchKernel(words, other, begin, end);
+}
+
+QHT_TARGET_AVX512 inline size_t FindMismatchAvx512(const uint64_t* words, const uint64_t* other, const size_t begin, const size_t end) {
+	return FindMismatchKernel(words, other, begin, end);
+}
+
+QHT_TARGET_AVX2 inline bool ContainsWordAvx2(const uint64_t* words, const size_t n_words, const uint64_t word) {
+	return ContainsWordKernel(words, n_words, word);
+}
+
+QHT_TARGET_AVX512 inline bool ContainsWordAvx512(const uint64_t* words, const size_t n_words, const uint64_t word) {
+	return ContainsWordKernel(words, n_words, word);
+}
+
+#endif
+
+}
+
+inline bool WordsNeedMerge(const uint64_t* words, const uint64_t* other, const size_t n_words) {
+	/**
+	 * Tells whether merging `other` into `words` can change anything: it cannot if `other` is empty
+	 * or identical. Written branch-free so that it gets vectorized.
+	 * @returns false if the n_words words of other are all zero or equal to those of words
+	 */
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return packed_detail::WordsNeedMergeAvx512(words, other, n_words);
+	case kCpuAvx2: return packed_detail::WordsNeedMergeAvx2(words, other, n_words);
+	default: break;
+	}
+#endif
+	return packed_detail::WordsNeedMergeKernel(words, other, n_words);
+}
+
+typedef size_t (*FindBlockToMergeFunction)(const uint64_t*, const uint64_t*, const size_t, const size_t, const size_t, const size_t);
+
+inline FindBlockToMergeFunction SelectFindBlockToMerge() {
+	/**
+	 * Variant for this CPU of find_block(words, other, n_words, block_words, block, end_block): the first block in
+	 * block..end_block - 1 (blocks of block_words words, the last one cut at n_words) for which WordsNeedMerge is true,
+	 * or end_block. Meant to be resolved once per merge, a call then skipping all the blocks that need nothing.
+	 */
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return packed_detail::FindBlockToMergeAvx512;
+	case kCpuAvx2: return packed_detail::FindBlockToMergeAvx2;
+	default: break;
+	}
+#endif
+	return packed_detail::FindBlockToMergeBaseline;
+}
+
+inline size_t FindMismatch(const uint64_t* words, const uint64_t* other, const size_t begin, const size_t end) {
+	/**
+	 * Finds the first word that differs between two packed storages.
+	 * Identical blocks of 16 words (two cache lines) are skipped with a branch-free, vectorized comparison.
+	 * @returns the index of the first differing word in begin..end - 1, or end if there is none
+	 */
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return packed_detail::FindMismatchAvx512(words, other, begin, end);
+	case kCpuAvx2: return packed_detail::FindMismatchAvx2(words, other, begin, end);
+	default: break;
+	}
+#endif
+	return packed_detail::FindMismatchKernel(words, other, begin, end);
+}
+
+inline bool ContainsWord(const uint64_t* words, const size_t n_words, const uint64_t word) {
+	/**
+	 * Tells whether a word is among n_words words, comparing all of them without branches so that it gets
+	 * vectorized: meant for short arrays that stay in cache (see OverflowStash)
+	 */
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return packed_detail::ContainsWordAvx512(words, n_words, word);
+	case kCpuAvx2: return packed_detail::ContainsWordAvx2(words, n_words, word);
+	default: break;
+	}
+#endif
+	return packed_detail::ContainsWordKernel(words, n_words, word);
+}
+
+QHT_ALWAYS_INLINE uint64_t FoldFields(const uint64_t word, const uint64_t next, const size_t width) {
+	/**
+	 * ORs the `width` bits starting at every position of `word` into that position, borrowing the bits
+	 * of `next` at the end of the word. Windows of 1, 2, 4... bits are combined following the binary
+	 * decomposition of width, which takes log2(width) steps instead of width.
+	 * When width is a constant, the loop unrolls into a handful of shifts.
+	 */
+	uint64_t window_high = word, window_low = next;   // OR of `size` consecutive bits
+	uint64_t folded = 0;                              // OR of `done` consecutive bits
+	size_t size = 1, done = 0;
+
+	for(auto remaining = width; remaining != 0; remaining >>= 1) {
+		if(remaining & 1) {
+			folded |= done == 0 ? window_high : (window_high << done) | (window_low >> (64 - done));
+			done += size;
+		}
+		if(remaining > 1) {
+			window_high |= (window_high << size) | (window_low >> (64 - size));
+			window_low |= window_low << size;
+			size <<= 1;
+		}
+	}
+
+	return folded;
+}
+
+struct FieldScanner {
+	/**
+	 * Counts the nonzero fields (e.g. non-empty buckets) of a packed storage made of fields of `width` bits,
+	 * word by word rather than field by field.
+	 * In each word, the bits of a field are OR-ed into its first bit (see FoldFields), then the first bits
+	 * of the fields are selected by a mask and counted. Field boundaries repeat every `period` words, hence
+	 * `period` masks. Common widths get a specialized loop, in which the fold and the masks are constants.
+	 */
+	size_t width;
+	size_t period;
+	uint64_t masks[64];
+
+	explicit FieldScanner(const size_t n_width) : width(n_width), period(n_width / std::gcd(n_width, size_t(64))), masks() {
+		for(size_t j = 0; j < period; ++j) {
+			masks[j] = 0;
+			for(size_t bit = 0; bit < 64; ++bit) {
+				if((64 * j + bit) % width == 0) {
+					masks[j] |= uint64_t(1) << (63 - bit);
+				}
+			}
+		}
+	}
+
+	size_t CountNonZero(const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) const;
+
+	QHT_ALWAYS_INLINE size_t CountNonZeroKernel(const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) const {
+		/** CountNonZero, inlined into a variant per instruction set */
+		switch(width) {
+		case 1: return Scan<1>(words, n_words, begin, end);
+		case 2: return Scan<2>(words, n_words, begin, end);
+		case 3: return Scan<3>(words, n_words, begin, end);
+		case 4: return Scan<4>(words, n_words, begin, end);
+		case 5: return Scan<5>(words, n_words, begin, end);
+		case 6: return Scan<6>(words, n_words, begin, end);
+		case 7: return Scan<7>(words, n_words, begin, end);
+		case 8: return Scan<8>(words, n_words, begin, end);
+		default: return Scan<0>(words, n_words, begin, end);
+		}
+	}
+
+	template <size_t W> QHT_ALWAYS_INLINE size_t Scan(const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) const {
+		/** CountNonZero for a width of W bits, or of `width` bits if W is 0 */
+		const size_t w = W == 0 ? width : W;
+		const size_t p = W == 0 ? period : W / std::gcd(W, size_t(64));
+
+		size_t count = 0;
+		size_t i = begin;
+		size_t j = begin % p;
+		const size_t last = std::min(end, n_words - 1);
+
+		// Up to the next period boundary, then whole periods, during which the masks are known
+		for(; i < last && j != 0; ++i, j = j + 1 == p ? 0 : j + 1) {
+			count += __builtin_popcountll(FoldFields(words[i], words[i + 1], w) & masks[j]);
+		}
+		for(; i + p <= last; i += p) {
+			for(size_t k = 0; k < p; ++k) {
+				count += __builtin_popcountll(FoldFields(words[i + k], words[i + k + 1], w) & masks[k]);
+			}
+		}
+		for(; i < last; ++i, j = j + 1 == p ? 0 : j + 1) {
+			count += __builtin_popcountll(FoldFields(words[i], words[i + 1], w) & masks[j]);
+		}
+
+		// The last word of the storage has no next word
+		if(i < end) {
+			count += __builtin_popcountll(FoldFields(words[i], 0, w) & masks[j]);
+		}
+
+		return count;
+	}
+
+	size_t CountFields(const size_t n_bits, const size_t begin, const size_t end) const {
+		/** @returns the number of fields starting in words begin..end - 1 of a storage of n_bits bits */
+		auto first = std::min(64 * begin, n_bits);
+		auto last = std::min(64 * end, n_bits);
+		return (last + width - 1) / width - (first + width - 1) / width;
+	}
+};
+
+namespace packed_detail {
+
+#if QHT_X86_DISPATCH
+
+QHT_TARGET_AVX2 inline size_t CountNonZeroAvx2(const FieldScanner& scanner, const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) {
+	return scanner.CountNonZeroKernel(words, n_words, begin, end);
+}
+
+QHT_TARGET_AVX512 inline size_t CountNonZeroAvx512(const FieldScanner& scanner, const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) {
+	return scanner.CountNonZeroKernel(words, n_words, begin, end);
+}
+
+#endif
+
+}
+
+inline size_t FieldScanner::CountNonZero(const uint64_t* words, const size_t n_words, const size_t begin, const size_t end) const {
+	/**
+	 * @param words: packed storage of n_words words
+	 * @param begin, end: range of words to scan
+	 * @returns the number of nonzero fields starting in words begin..end - 1
+	 */
+#if QHT_X86_DISPATCH
+	switch(GetCpuLevel()) {
+	case kCpuAvx512: return packed_detail::CountNonZeroAvx512(*this, words, n_words, begin, end);
+	case kCpuAvx2: return packed_detail::CountNonZeroAvx2(*this, words, n_words, begin, end);
+	default: break;
+	}
+#endif
+	return CountNonZeroKernel(words, n_words, begin, end);
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(QHT_ENABLE_PHASE_TIMING) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+/**
+ * Attribution of the cycles of Stream, Lookup and Delete to their phases: Hash1 (address), Hash2 (fingerprint),
+ * the fingerprint retry loop, the cell probe and the write (insertion, eviction or deletion shift).
+ *
+ * Only compiled in when QHT_ENABLE_PHASE_TIMING is defined (e.g. make CXXFLAGS=-DQHT_ENABLE_PHASE_TIMING),
+ * otherwise the QHT_PHASE_* macros compile to nothing and CollectPhaseProfile() reports zeros.
+ * Each thread accumulates into its own buffer (cycle counter deltas, no synchronization on the hot path);
+ * CollectPhaseProfile() sums the buffers of all threads, including threads that already exited.
+ * Every lap reads the cycle counter, which costs tens of cycles (more in virtual machines) and is charged
+ * to the phase that ends: compare phases with each other rather than with uninstrumented timings.
+ */
+
+enum PhaseOperation { kPhaseStream, kPhaseLookup, kPhaseDelete, kPhaseOperations };
+enum Phase { kPhaseHash1, kPhaseHash2, kPhaseRetry, kPhaseProbe, kPhaseWrite, kPhases };
+
+#ifdef QHT_ENABLE_PHASE_TIMING
+const bool kPhaseTimingEnabled = true;
+#else
+const bool kPhaseTimingEnabled = false;
+#endif
+
+/** Totals of all threads at a given time */
+struct PhaseProfile {
+	uint64_t operations[kPhaseOperations] = {};
+	uint64_t cycles[kPhaseOperations][kPhases] = {};
+
+	static const char* OperationName(const size_t operation) {
+		static const char* names[kPhaseOperations] = {"stream", "lookup", "delete"};
+		return names[operation];
+	}
+
+	static const char* PhaseName(const size_t phase) {
+		static const char* names[kPhases] = {"hash1", "hash2", "retry", "probe", "write"};
+		return names[phase];
+	}
+
+	double CyclesPerOperation(const size_t operation, const size_t phase) const {
+		return operations[operation] == 0 ? 0. : double(cycles[operation][phase]) / double(operations[operation]);
+	}
+};
+
+#ifdef QHT_ENABLE_PHASE_TIMING
+
+inline uint64_t PhaseCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+struct PhaseBuffer {
+	/** Counters of one thread: single writer, relaxed atomics so that CollectPhaseProfile can read them at any time */
+	std::atomic<uint64_t> operations[kPhaseOperations];
+	std::atomic<uint64_t> cycles[kPhaseOperations][kPhases];
+
+	PhaseBuffer() : operations(), cycles() { Reset(); }
+
+	static void Add(std::atomic<uint64_t>& counter, const uint64_t value) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	void Reset() {
+		for(size_t op = 0; op < kPhaseOperations; ++op) {
+			operations[op].store(0, std::memory_order_relaxed);
+			for(size_t phase = 0; phase < kPhases; ++phase) {
+				cycles[op][phase].store(0, std::memory_order_relaxed);
+			}
+		}
+	}
+};
+
+struct PhaseRegistry {
+	/** Buffers of all the threads that ever timed an operation */
+	std::mutex mutex;
+	std::vector<std::shared_ptr<PhaseBuffer>> buffers;
+
+	PhaseRegistry() : mutex(), buffers() {}
+
+	static PhaseRegistry& Instance() {
+		static PhaseRegistry registry;
+		return registry;
+	}
+};
+
+struct PhaseClock {
+	std::shared_ptr<PhaseBuffer> buffer;
+	uint64_t last;
+	size_t operation;
+	bool active;
+
+	PhaseClock() : buffer(std::make_shared<PhaseBuffer>()), last(0), operation(0), active(false) {
+		auto& registry = PhaseRegistry::Instance();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.buffers.push_back(buffer);
+	}
+
+	static PhaseClock& Thread() {
+		thread_local PhaseClock clock;
+		return clock;
+	}
+};
+
+inline void PhaseStart(const PhaseOperation operation) {
+	auto& clock = PhaseClock::Thread();
+	clock.operation = operation;
+	clock.active = true;
+	clock.last = PhaseCycles();
+}
+
+inline void PhaseLap(const Phase phase) {
+	/** Attributes the cycles since the previous lap (or the start) to phase, if an operation is being timed */
+	auto& clock = PhaseClock::Thread();
+	if(!clock.active) {
+		return;
+	}
+	auto now = PhaseCycles();
+	PhaseBuffer::Add(clock.buffer->cycles[clock.operation][phase], now - clock.last);
+	clock.last = now;
+}
+
+inline void PhaseStop() {
+	auto& clock = PhaseClock::Thread();
+	if(clock.active) {
+		PhaseBuffer::Add(clock.buffer->operations[clock.operation], 1);
+		clock.active = false;
+	}
+}
+
+#define QHT_PHASE_START(operation) PhaseStart(operation)
+#define QHT_PHASE(phase) PhaseLap(phase)
+#define QHT_PHASE_STOP() PhaseStop()
+
+#else
+
+#define QHT_PHASE_START(operation) ((void) 0)
+#define QHT_PHASE(phase) ((void) 0)
+#define QHT_PHASE_STOP() ((void) 0)
+
+#endif
+
+inline PhaseProfile CollectPhaseProfile() {
+	/** @returns the sum of the counters of all threads */
+	PhaseProfile profile;
+#ifdef QHT_ENABLE_PHASE_TIMING
+	auto& registry = PhaseRegistry::Instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for(auto& buffer: registry.buffers) {
+		for(size_t op = 0; op < kPhaseOperations; ++op) {
+			profile.operations[op] += buffer->operations[op].load(std::memory_order_relaxed);
+			for(size_t phase = 0; phase < kPhases; ++phase) {
+				profile.cycles[op][phase] += buffer->cycles[op][phase].load(std::memory_order_relaxed);
+			}
+		}
+	}
+#endif
+	return profile;
+}
+
+inline void ResetPhaseProfile() {
+	/** Zeroes the counters of all threads. Operations being timed by other threads at the same time may be partly lost. */
+#ifdef QHT_ENABLE_PHASE_TIMING
+	auto& registry = PhaseRegistry::Instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for(auto& buffer: registry.buffers) {
+		buffer->Reset();
+	}
+#endif
+}
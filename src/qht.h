@@ -1,12 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <initializer_list>
+#include <numeric>
 #include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <boost/functional/hash.hpp>
 
+#include "batch.h"
+#include "encoding.h"
 #include "hash.h"
+#include "packed.h"
+#include "phases.h"
+#include "stats.h"
 
-template <class T> struct QHTFilter {
+/** Filter of elements of type T, hashed with HashPolicy (see hash.h) */
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct QHTFilter {
 
 protected:
 	size_t array_size;
@@ -15,30 +27,104 @@ protected:
 	size_t fingerprint_size;
 
 	std::mt19937 rng;
-	std::uniform_int_distribution<size_t> bucket_selector;
 
-	std::vector<bool> qht;
+	PackedBits qht;
 
-	uint64_t Fingerprint(const T& e);
-	size_t Address(const T& e);
+	QHTCounters counters;
+
+	/** Outcome of the insertion of a fingerprint in a cell */
+	enum Insertion { kPresent, kEmptyBucket, kEviction };
+
+	template <class K> uint64_t Fingerprint(const K& e);
+	template <class K> size_t Address(const K& e);
+	template <class K> bool LookupKey(const K& e);
+	template <class K> bool InsertKey(const K& e);
+	template <class K> bool StreamKey(const K& e);
+	template <class K> bool DeleteKey(const K& e);
+	template <class K> static KeyHandle PrehashKey(const K& e);
+	template <class Operation> void ForEachInBatch(const T* keys, const size_t n, bool* results, Operation operation);
+	template <class Prefetch, class Operation> void ForEachInBatch(const T* keys, const size_t n, bool* results, Prefetch prefetch, Operation operation);
+	void PrefetchCell(const uint64_t address) const { __builtin_prefetch(qht.data() + address * n_buckets * fingerprint_size / 64); }
 	bool InCell(const uint64_t address, const uint64_t fingerprint) const;
+	Insertion InsertInCell(const uint64_t address, const uint64_t fingerprint, std::mt19937& generator);
+	bool CountInsertion(const Insertion insertion);
+	bool RemoveFromCell(const uint64_t address, const uint64_t fingerprint);
 	bool InsertFingerprintInBucket(const uint64_t address, const size_t bucket_number, const uint64_t fingerprint);
 	uint64_t GetFingerprintFromBucket(const uint64_t address, const size_t bucket_number) const;
+	template <class CellMerger> void MergeCells(const QHTFilter& other, const size_t n_threads, CellMerger merge_cell);
+	void PutHeader(ByteBuffer& out, const uint8_t kind) const;
+	bool GetHeader(const uint8_t*& cursor, const uint8_t* end, const uint8_t kind) const;
 
 public:
 	QHTFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size);
-	bool Lookup(const T& e);
-	bool Insert(const T& e);
-	bool Stream(const T& e);
-	bool Delete(const T& e);
+	bool Lookup(const T& e) { return LookupKey(e); }
+	bool Insert(const T& e) { return InsertKey(e); }
+	bool Stream(const T& e) { return StreamKey(e); }
+	bool Delete(const T& e) { return DeleteKey(e); }
 	void Reset();
+
+	// Same operations on the bytes of a key (see KeyBytes), without building a T
+	bool Lookup(const std::string_view bytes) { return LookupKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Insert(const std::string_view bytes) { return InsertKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Stream(const std::string_view bytes) { return StreamKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Delete(const std::string_view bytes) { return DeleteKey(KeyBytes{bytes.data(), bytes.size()}); }
+	template <class C, IfCString<C> = 0> bool Lookup(const C* bytes) { return Lookup(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Insert(const C* bytes) { return Insert(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Delete(const C* bytes) { return Delete(std::string_view(bytes)); }
+	bool Lookup(const void* data, const size_t size) { return LookupKey(KeyBytes{data, size}); }
+	bool Insert(const void* data, const size_t size) { return InsertKey(KeyBytes{data, size}); }
+	bool Stream(const void* data, const size_t size) { return StreamKey(KeyBytes{data, size}); }
+	bool Delete(const void* data, const size_t size) { return DeleteKey(KeyBytes{data, size}); }
+
+	// Hash a key once (on any thread, no filter state is involved), then run operations on any filter with the handle
+	static KeyHandle Prehash(const T& e) { return PrehashKey(e); }
+	static KeyHandle Prehash(const std::string_view bytes) { return Prehash(bytes.data(), bytes.size()); }
+	template <class C, IfCString<C> = 0> static KeyHandle Prehash(const C* bytes) { return Prehash(std::string_view(bytes)); }
+	static KeyHandle Prehash(const void* data, const size_t size) { return PrehashKey(KeyBytes{data, size}); }
+	bool LookupHandle(const KeyHandle& handle) { return LookupKey(handle); }
+	bool InsertHandle(const KeyHandle& handle) { return InsertKey(handle); }
+	bool StreamHandle(const KeyHandle& handle) { return StreamKey(handle); }
+	bool DeleteHandle(const KeyHandle& handle) { return DeleteKey(handle); }
+
+	// Composite keys: the fields (FieldBytes) or fragments (KeyBytes) hash as their concatenation, without building it
+	static KeyHandle PrehashParts(const std::initializer_list<KeyBytes> parts) { return PolicyHashParts<HashPolicy>(KeyParts{parts.begin(), parts.size()}); }
+	template <class... Fields> static KeyHandle PrehashFields(const Fields&... fields) { return PrehashParts({FieldBytes(fields)...}); }
+	bool LookupParts(const std::initializer_list<KeyBytes> parts) { return LookupKey(PrehashParts(parts)); }
+	bool StreamParts(const std::initializer_list<KeyBytes> parts) { return StreamKey(PrehashParts(parts)); }
+	template <class... Fields> bool LookupFields(const Fields&... fields) { return LookupKey(PrehashFields(fields...)); }
+	template <class... Fields> bool StreamFields(const Fields&... fields) { return StreamKey(PrehashFields(fields...)); }
+#if QHT_IOVEC
+	// A key scattered across buffers (iovec ranges), hashed as the contiguous key without reassembling it
+	static KeyHandle PrehashParts(const iovec* ranges, const size_t count) { return PolicyHashParts<HashPolicy>(ranges, count); }
+	bool LookupParts(const iovec* ranges, const size_t count) { return LookupKey(PrehashParts(ranges, count)); }
+	bool StreamParts(const iovec* ranges, const size_t count) { return StreamKey(PrehashParts(ranges, count)); }
+#endif
+
+	// Batches: keys are hashed together (see HashBatch) and their cells prefetched, then processed in order,
+	// results[i] being what one call per key would return
+	void LookupBatch(const T* keys, const size_t n, bool* results);
+	void StreamBatch(const T* keys, const size_t n, bool* results);
+
+	bool Compatible(const QHTFilter& other) const;
+	void Merge(const QHTFilter& other, const size_t n_threads = 1);
+
+	ByteBuffer Diff(const QHTFilter& base) const;
+	bool ApplyDelta(const ByteBuffer& delta);
+
+	ByteBuffer Snapshot(const bool compressed = false) const;
+	bool Restore(const ByteBuffer& snapshot);
+
+	QHTStats Stats() const;
+	void ResetStats();
+	double Occupancy(const double sampled_fraction = 1.) const;
 };
 
-template <class T> QHTFilter<T>::QHTFilter(
+template <class T, class HashPolicy> QHTFilter<T, HashPolicy>::QHTFilter(
 	const uint64_t memory_size,
 	const size_t n_n_buckets,
 	const size_t n_fingerprint_size
-) : n_buckets(n_n_buckets), fingerprint_size(n_fingerprint_size)
+) : array_size(memory_size), n_cells(0), n_buckets(n_n_buckets), fingerprint_size(n_fingerprint_size), rng(), qht(), counters()
 {
 	n_cells = memory_size / (n_buckets * fingerprint_size);
 	assert(n_cells > 0);
@@ -46,17 +132,17 @@ template <class T> QHTFilter<T>::QHTFilter(
 	Reset();
 }
 
-template <class T> size_t QHTFilter<T>::Address(const T& e) {
+template <class T, class HashPolicy> template <class K> size_t QHTFilter<T, HashPolicy>::Address(const K& e) {
 	/** Get the address of an element
 	 *
-	 * @param T e the element
+	 * @param e the element, the bytes of the element (KeyBytes) or its hashes (KeyHandle)
 	 * @return size_t address the address of the element in the filter
 	 */
-	return Hash1(e) % n_cells;
+	return PolicyHash1<HashPolicy>(e) % n_cells;
 }
 
 
-template <class T> uint64_t QHTFilter<T>::Fingerprint(const T& e) {
+template <class T, class HashPolicy> template <class K> uint64_t QHTFilter<T, HashPolicy>::Fingerprint(const K& e) {
 	/** Get the fingerprint of an element
 	 * 0 is a reserved value and as such cannot be used as a fingerprint
 	 * For this reason we iterate on hashing until we find a nonzero fingerprint
@@ -64,121 +150,139 @@ template <class T> uint64_t QHTFilter<T>::Fingerprint(const T& e) {
 	 * This configuration makes sure every fingerprint is equiprobable
 	 * (at the cost of slight computing overhead)
 	 *
-	 * @param T e the element
+	 * @param e the element, the bytes of the element (KeyBytes) or its hashes (KeyHandle)
 	 * @return int fingerprint of e
 	 */
 
 	// Note: the hash must be independent from Hash1 which already provides `address`
-	HashValue hash = Hash2(e);
+	HashValue hash = PolicyHash2<HashPolicy>(e);
+	QHT_PHASE(kPhaseHash2);
 
-	uint64_t fingerprint = hash & ((1 << fingerprint_size) - 1);
+	const uint64_t mask = (uint64_t(1) << fingerprint_size) - 1;
+	uint64_t fingerprint = hash & mask;
 
 	int adder = 0;
 	// TODO std::hash(hash + ++adder) seems to have poor statistical properties as this loop is run a bit too often to my taste
 	while(fingerprint == 0) {
 		boost::hash_combine(hash, hash + ++adder);  // adder avoids potential infinite loops with fixed points (such as 11754104648456392440)
-		fingerprint = hash & ((1 << fingerprint_size) - 1);
+		fingerprint = hash & mask;
 	}
+	QHT_PHASE(kPhaseRetry);
 
 	return fingerprint;
 }
 
-template <class T> bool QHTFilter<T>::Lookup(const T& e) {
+template <class T, class HashPolicy> template <class K> KeyHandle QHTFilter<T, HashPolicy>::PrehashKey(const K& e) {
+	/** @returns both hashes of an element or of its bytes, with a single mix if the policy allows it */
+	const auto& key = PolicyKey<HashPolicy>(e);
+	return KeyHandle{PolicyHash1<HashPolicy>(key), PolicyHash2<HashPolicy>(key)};
+}
 
-	/** Returns true if the element e is detected inside the filter
-	 * @param e
-	 * @returns boolean
+template <class T, class HashPolicy> template <class Operation> void QHTFilter<T, HashPolicy>::ForEachInBatch(
+	const T* keys,
+	const size_t n,
+	bool* results,
+	Operation operation
+) {
+	/**
+	 * Runs operation(handle) on the keys, kBatchSize at a time: all the keys of a batch are hashed first, then
+	 * the cache lines of their cells are prefetched, so that the cells of a batch are fetched from memory in parallel
 	 */
+	ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { PrefetchCell(Address(handle)); }, operation);
+}
 
-	auto address = Address(e);
-	auto fingerprint = Fingerprint(e);
+template <class T, class HashPolicy> template <class Prefetch, class Operation> void QHTFilter<T, HashPolicy>::ForEachInBatch(
+	const T* keys,
+	const size_t n,
+	bool* results,
+	Prefetch prefetch,
+	Operation operation
+) {
+	/** Same as above, prefetch(handle) fetching the cells the operation will read */
+	KeyHandle handles[kBatchSize];
+
+	for(size_t begin = 0; begin < n; begin += kBatchSize) {
+		const size_t count = std::min(kBatchSize, n - begin);
+		HashBatch<HashPolicy>(keys + begin, count, handles);
+
+		for(size_t i = 0; i < count; ++i) {
+			prefetch(handles[i]);
+		}
+		for(size_t i = 0; i < count; ++i) {
+			results[begin + i] = operation(handles[i]);
+		}
+	}
+}
 
-	return InCell(address, fingerprint);
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::LookupBatch(const T* keys, const size_t n, bool* results) {
+	ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return LookupKey(handle); });
 }
 
-template <class T> bool QHTFilter<T>::Insert(const T& e) {
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::StreamBatch(const T* keys, const size_t n, bool* results) {
+	ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return StreamKey(handle); });
+}
 
-	/** Inserts element e in the filter if not already present
+template <class T, class HashPolicy> template <class K> bool QHTFilter<T, HashPolicy>::LookupKey(const K& e) {
+
+	/** Returns true if the element e is detected inside the filter
 	 * @param e
-	 * @returns true
+	 * @returns boolean
 	 */
 
-	auto address = Address(e);
-	auto fingerprint = Fingerprint(e);
+	QHT_PHASE_START(kPhaseLookup);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = Fingerprint(key);
 
-	// Run from all buckets, left to right. Stops at element, or first empty cell.
-	// If it stops at empty cell the element is not present.
-	bool detected = false;
-	size_t bucket_number = 0;
-	auto current_fingerprint = GetFingerprintFromBucket(address, bucket_number);
+	auto found = InCell(address, fingerprint);
+	QHT_PHASE(kPhaseProbe);
+	QHT_PHASE_STOP();
 
-	while(!detected && current_fingerprint != 0 && bucket_number < n_buckets) {
-		detected = (fingerprint == GetFingerprintFromBucket(address, bucket_number));
+	return found;
+}
 
-		if(!detected) {
-			++bucket_number;
-		}
-	}
+template <class T, class HashPolicy> template <class K> bool QHTFilter<T, HashPolicy>::InsertKey(const K& e) {
 
-	// Do not insert an element already present
-	if(detected) {
-		return true;
-	}
+	/** Inserts element e in the filter if not already present
+	 * @param e
+	 * @returns true
+	 */
 
-	// Try to insert in empty bucket if possible
-	if(current_fingerprint == 0) {
-		InsertFingerprintInBucket(address, bucket_number, fingerprint);
-		return true;
-	}
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = Address(key);
+	auto fingerprint = Fingerprint(key);
 
-	// No empty bucket, inserting in random bucket (erasing previous content)
-	InsertFingerprintInBucket(address, bucket_selector(rng), fingerprint);
+	CountInsertion(InsertInCell(address, fingerprint, rng));
 
 	return true;
 }
 
-template <class T> bool QHTFilter<T>::Stream(const T& e) {
+template <class T, class HashPolicy> template <class K> bool QHTFilter<T, HashPolicy>::StreamKey(const K& e) {
 	/** Inserts element e in the filter if not already present
 	 * Is equivalent to Detect(e) followed by Insert(e), but faster (only one round of hashing)
 	 *
 	 * @param e
 	 * @returns boolean being true if the element was already in the filter, false otherwise
 	 */
-	auto address = Address(e);
-	auto fingerprint = Fingerprint(e);
-
-	// Run from all buckets, left to right. Stops at element, or first empty cell (empty cells contain 0).
-	// If it stops at empty cell the element is not present.
-	bool detected = false;
-	size_t bucket_number = 0;
-	auto current_fingerprint = GetFingerprintFromBucket(address, bucket_number);
-
-	while(!detected && current_fingerprint != 0 && bucket_number < n_buckets) {
-		detected = (fingerprint == GetFingerprintFromBucket(address, bucket_number));
+	QHT_PHASE_START(kPhaseStream);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = Fingerprint(key);
 
-		if(!detected) {
-			++bucket_number;
-		}
-	}
+	auto detected = CountInsertion(InsertInCell(address, fingerprint, rng));
+	QHT_PHASE_STOP();
 
-	// Do not insert an element already present
+	counters.streams.Increment();
 	if(detected) {
-		return true;
+		counters.duplicates.Increment();
 	}
 
-	// Try to insert in empty bucket if possible
-	if(current_fingerprint == 0) {
-		InsertFingerprintInBucket(address, bucket_number, fingerprint);
-		return false;
-	}
-
-	// No empty bucket, inserting in random bucket (erasing previous content)
-	InsertFingerprintInBucket(address, bucket_selector(rng), fingerprint);
-
-	return false;
+	return detected;
 }
 
-template <class T> bool QHTFilter<T>::Delete(const T& e) {
+template <class T, class HashPolicy> template <class K> bool QHTFilter<T, HashPolicy>::DeleteKey(const K& e) {
 	/**
 	 * Deletes an element e from the QHT.
 	 * This function deletes one element in the QHT that has the same hash and the same fingerprint as e
@@ -194,10 +298,30 @@ template <class T> bool QHTFilter<T>::Delete(const T& e) {
 	 * @returns bool: true if the element, or a false duplicate, is found (and deleted),
 	 *                false if no such element is found.
 	 */
-	bool element_found = false;
+	QHT_PHASE_START(kPhaseDelete);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = Fingerprint(key);
+
+	auto element_found = RemoveFromCell(address, fingerprint);
+	QHT_PHASE_STOP();
+
+	if(element_found) {
+		counters.deletes.Increment();
+	} else {
+		counters.failed_deletes.Increment();
+	}
 
-	auto address = Address(e);
-	auto fingerprint = Fingerprint(e);
+	return element_found;
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::RemoveFromCell(const uint64_t address, const uint64_t fingerprint) {
+	/**
+	 * Removes one copy of a fingerprint from a cell
+	 * @returns true if the fingerprint was in the cell
+	 */
+	bool element_found = false;
 
 	size_t i = 0;
 	while(! element_found && i < n_buckets) {
@@ -208,6 +332,8 @@ template <class T> bool QHTFilter<T>::Delete(const T& e) {
 		}
 	}
 
+	QHT_PHASE(kPhaseProbe);
+
 	if(! element_found) {
 		return false;
 	}
@@ -221,11 +347,12 @@ template <class T> bool QHTFilter<T>::Delete(const T& e) {
 	// Re-set the last element of the list to `Empty`. Also covers the case where the e to be removed
 	// is the last element of the list.
 	InsertFingerprintInBucket(address, n_buckets - 1, 0);
+	QHT_PHASE(kPhaseWrite);
 
 	return true;
 }
 
-template <class T> uint64_t QHTFilter<T>::GetFingerprintFromBucket(const uint64_t address, const size_t bucket_number) const {
+template <class T, class HashPolicy> uint64_t QHTFilter<T, HashPolicy>::GetFingerprintFromBucket(const uint64_t address, const size_t bucket_number) const {
 
 	/**
 	 * All bits are stored in sequence.
@@ -237,7 +364,7 @@ template <class T> uint64_t QHTFilter<T>::GetFingerprintFromBucket(const uint64_
 	 * @returns to be documented
 	 */
 
-	uint64_t fingerprint = 0;
+	assert(address < n_cells && bucket_number < n_buckets);
 
 	// The cell `address` starts here
 	auto offset = address * n_buckets * fingerprint_size;
@@ -245,17 +372,12 @@ template <class T> uint64_t QHTFilter<T>::GetFingerprintFromBucket(const uint64_
 	// We add the offset of the number of buckets we want
 	offset += bucket_number * fingerprint_size;
 
-	// We rebuild the fingerprint bit per bit
 	// Most significant bit has the lowest index
-	for(size_t i = 0; i < fingerprint_size; ++i) {
-		fingerprint = (fingerprint << 1) + qht.at(offset + i);
-	}
-
-	return fingerprint;
+	return ReadBits(qht.data(), offset, fingerprint_size);
 }
 
 
-template <class T> bool QHTFilter<T>::InsertFingerprintInBucket(const uint64_t address, const size_t bucket_number, const uint64_t fingerprint) {
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::InsertFingerprintInBucket(const uint64_t address, const size_t bucket_number, const uint64_t fingerprint) {
 	
 	/** Takes a fingerprint, and inserts it in the given bucket number of a given cell (address)
 	 * @param address
@@ -264,20 +386,17 @@ template <class T> bool QHTFilter<T>::InsertFingerprintInBucket(const uint64_t a
 	 * @returns true
 	 */
 
+	assert(address < n_cells && bucket_number < n_buckets);
+
 	auto offset = address * n_buckets * fingerprint_size + bucket_number * fingerprint_size;
 
-	auto bits_to_insert = fingerprint;
-	// We store bits in the allocated slots
 	// Most significant bit has the smallest index
-	for(size_t i = 0; i < fingerprint_size; ++i) {
-		qht.at(offset + (fingerprint_size - i - 1)) = bits_to_insert & 0b1;
-		bits_to_insert = bits_to_insert >> 1;
-	}
+	WriteBits(qht.data(), offset, fingerprint_size, fingerprint);
 
 	return true;
 }
 
-template <class T> bool QHTFilter<T>::InCell(const uint64_t address, const uint64_t fingerprint) const {
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::InCell(const uint64_t address, const uint64_t fingerprint) const {
 
 	/** Return true if a fingerprint is in one of the buckets of a given cell (address)
 	 * @param address
@@ -294,10 +413,354 @@ template <class T> bool QHTFilter<T>::InCell(const uint64_t address, const uint6
 	return false;
 }
 
-template <class T> void QHTFilter<T>::Reset() {
+template <class T, class HashPolicy> typename QHTFilter<T, HashPolicy>::Insertion QHTFilter<T, HashPolicy>::InsertInCell(const uint64_t address, const uint64_t fingerprint, std::mt19937& generator) {
+
+	/** Inserts a fingerprint in a cell if not already present
+	 * The fingerprint goes to the first empty bucket, or replaces a random bucket if the cell is full.
+	 * @param address
+	 * @param fingerprint
+	 * @param generator: random generator used for evictions
+	 * @returns kPresent if the fingerprint was already in the cell, otherwise where it was inserted
+	 */
+
+	// Run from all buckets, left to right, remembering the first empty one (empty buckets contain 0).
+	size_t empty_bucket = n_buckets;
+	for(size_t bucket_number = 0; bucket_number < n_buckets; ++bucket_number) {
+		auto current_fingerprint = GetFingerprintFromBucket(address, bucket_number);
+
+		if(current_fingerprint == fingerprint) {
+			QHT_PHASE(kPhaseProbe);
+			return kPresent;
+		}
+		if(current_fingerprint == 0 && empty_bucket == n_buckets) {
+			empty_bucket = bucket_number;
+		}
+	}
+	QHT_PHASE(kPhaseProbe);
+
+	auto insertion = kEmptyBucket;
+
+	// No empty bucket, inserting in random bucket (erasing previous content)
+	if(empty_bucket == n_buckets) {
+		empty_bucket = std::uniform_int_distribution<size_t>(0, n_buckets - 1)(generator);
+		insertion = kEviction;
+	}
+
+	InsertFingerprintInBucket(address, empty_bucket, fingerprint);
+	QHT_PHASE(kPhaseWrite);
+
+	return insertion;
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::CountInsertion(const Insertion insertion) {
+	/**
+	 * Updates the counters after an insertion in a cell
+	 * @returns true if the fingerprint was already present
+	 */
+	if(insertion == kEmptyBucket) {
+		counters.empty_inserts.Increment();
+	} else if(insertion == kEviction) {
+		counters.evictions.Increment();
+	}
+
+	return insertion == kPresent;
+}
+
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::Reset() {
 	/**
 	 * Re-set all cells to 0 (Empty)
 	 * Also sets the QHT table to its assigned capacity, if not already done.
 	 */
-	qht.assign(n_cells * n_buckets * fingerprint_size, 0);
+	qht.assign(PackedWords(n_cells * n_buckets * fingerprint_size), 0);
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::Compatible(const QHTFilter& other) const {
+	/**
+	 * Two filters are compatible if they have the same geometry, in which case
+	 * the same element has the same address and fingerprint in both.
+	 * @param other
+	 * @returns boolean
+	 */
+	return n_cells == other.n_cells && n_buckets == other.n_buckets && fingerprint_size == other.fingerprint_size;
+}
+
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::Merge(const QHTFilter& other, const size_t n_threads) {
+	/**
+	 * Merges a compatible filter into this one, cell by cell.
+	 * Every fingerprint of `other` is inserted in the same cell of this filter as Stream would do:
+	 * nothing happens if it is already there, otherwise it goes to an empty bucket or evicts a random one.
+	 *
+	 * @param other: filter with the same geometry (see Compatible)
+	 * @param n_threads: number of threads sharing the cells
+	 */
+	assert(Compatible(other));
+	if(&other == this) {
+		return;
+	}
+
+	MergeCells(other, n_threads, [this, &other](const uint64_t address, std::mt19937& generator) {
+		for(size_t i = 0; i < n_buckets; ++i) {
+			auto fingerprint = other.GetFingerprintFromBucket(address, i);
+			if(fingerprint != 0) {
+				InsertInCell(address, fingerprint, generator);
+			}
+		}
+	});
+}
+
+template <class T, class HashPolicy> template <class CellMerger> void QHTFilter<T, HashPolicy>::MergeCells(const QHTFilter& other, const size_t n_threads, CellMerger merge_cell) {
+	/**
+	 * Calls merge_cell(address, generator) on every cell that other may change.
+	 *
+	 * Cells are processed by blocks starting and ending on word boundaries. A block of `other` that is
+	 * empty or identical to ours is skipped after a vectorized scan of its words, without reading any bucket.
+	 * Blocks are split between n_threads threads: as no two threads write to the same word, they need
+	 * no synchronization. Each thread evicts with its own random generator, seeded from the filter's one.
+	 *
+	 * @param other: compatible filter
+	 * @param n_threads: number of threads
+	 * @param merge_cell: merges a cell of other into the same cell of this filter
+	 */
+	const size_t cell_size = n_buckets * fingerprint_size;
+
+	// Smallest number of cells spanning a whole number of words, grouped until a block is worth vectorizing
+	const size_t unit_cells = 64 / std::gcd(cell_size, size_t(64));
+	const size_t unit_words = unit_cells * cell_size / 64;
+	const size_t block_cells = unit_cells * std::max(size_t(1), size_t(8) / unit_words);
+	const size_t n_blocks = (n_cells + block_cells - 1) / block_cells;
+
+	// Blocks are a few words long: the scan for this CPU is resolved once, and each call skips all the blocks to leave as is
+	const size_t block_words = block_cells * cell_size / 64;
+	const size_t n_words = PackedWords(n_cells * cell_size);
+	const auto find_block = SelectFindBlockToMerge();
+
+	auto merge_blocks = [&, find_block](const size_t first_block, const size_t last_block, std::mt19937& generator) {
+		auto block = find_block(qht.data(), other.qht.data(), n_words, block_words, first_block, last_block);
+		while(block < last_block) {
+			auto first_cell = block * block_cells;
+			auto last_cell = std::min(n_cells, first_cell + block_cells);
+			for(auto address = first_cell; address < last_cell; ++address) {
+				merge_cell(address, generator);
+			}
+			block = find_block(qht.data(), other.qht.data(), n_words, block_words, block + 1, last_block);
+		}
+	};
+
+	if(n_threads <= 1 || n_blocks <= 1) {
+		merge_blocks(0, n_blocks, rng);
+		return;
+	}
+
+	const size_t blocks_per_thread = (n_blocks + n_threads - 1) / n_threads;
+
+	std::vector<std::mt19937> generators;
+	std::vector<std::thread> threads;
+	generators.reserve(n_threads);
+
+	for(size_t t = 0; t < n_threads && t * blocks_per_thread < n_blocks; ++t) {
+		generators.emplace_back(rng());
+		threads.emplace_back(merge_blocks, t * blocks_per_thread, std::min(n_blocks, (t + 1) * blocks_per_thread), std::ref(generators.back()));
+	}
+
+	for(auto& thread: threads) {
+		thread.join();
+	}
+}
+
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::PutHeader(ByteBuffer& out, const uint8_t kind) const {
+	/**
+	 * Header of the binary formats: "QHT", the kind of content, the geometry of the filter, then the id of its hash policy
+	 * @param out: buffer to append to
+	 * @param kind: 'D' for deltas, 'S' for snapshots, 'Z' for compressed snapshots
+	 */
+	out.insert(out.end(), {'Q', 'H', 'T', kind});
+	PutVarint(out, n_cells);
+	PutVarint(out, n_buckets);
+	PutVarint(out, fingerprint_size);
+	PutVarint(out, PolicyId<HashPolicy>::value);
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::GetHeader(const uint8_t*& cursor, const uint8_t* end, const uint8_t kind) const {
+	/**
+	 * Reads a header written by PutHeader
+	 * @returns true if the header has the expected kind and matches the geometry and the hash policy of this filter
+	 */
+	if(end - cursor < 4 || cursor[0] != 'Q' || cursor[1] != 'H' || cursor[2] != 'T' || cursor[3] != kind) {
+		return false;
+	}
+	cursor += 4;
+
+	uint64_t cells, buckets, bits, policy;
+	return GetVarint(cursor, end, cells) && GetVarint(cursor, end, buckets) && GetVarint(cursor, end, bits)
+		&& GetVarint(cursor, end, policy) && cells == n_cells && buckets == n_buckets && bits == fingerprint_size
+		&& policy == PolicyId<HashPolicy>::value;
+}
+
+template <class T, class HashPolicy> ByteBuffer QHTFilter<T, HashPolicy>::Diff(const QHTFilter& base) const {
+	/**
+	 * Encodes the changes between a previous state of the filter and the current one,
+	 * typically to bring a replica holding `base` up to date with ApplyDelta.
+	 *
+	 * The delta is a header (see PutHeader) followed by runs of changed words of the packed storage:
+	 * number of unchanged words since the previous run (varint), number of words of the run (varint),
+	 * then the new words (little-endian).
+	 *
+	 * @param base: compatible filter, e.g. a copy made at the last synchronization
+	 * @returns the delta
+	 */
+	assert(Compatible(base));
+
+	ByteBuffer delta;
+	PutHeader(delta, 'D');
+
+	const size_t n_words = qht.size();
+	size_t position = 0;
+
+	auto begin = FindMismatch(qht.data(), base.qht.data(), 0, n_words);
+	while(begin < n_words) {
+		auto end = begin + 1;
+		while(end < n_words && qht[end] != base.qht[end]) {
+			++end;
+		}
+
+		PutVarint(delta, begin - position);
+		PutVarint(delta, end - begin);
+		PutWords(delta, qht.data() + begin, end - begin);
+
+		position = end;
+		begin = FindMismatch(qht.data(), base.qht.data(), end, n_words);
+	}
+
+	return delta;
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::ApplyDelta(const ByteBuffer& delta) {
+	/**
+	 * Applies a delta produced by Diff. If this filter was in the `base` state, it ends up in the state of the filter
+	 * the delta was computed from. The delta is validated before anything is written.
+	 *
+	 * @param delta
+	 * @returns false (and leaves the filter untouched) if the delta is malformed or was made for another geometry
+	 */
+	const size_t n_words = qht.size();
+
+	for(auto apply: {false, true}) {
+		const uint8_t* cursor = delta.data();
+		const uint8_t* end = cursor + delta.size();
+		size_t position = 0;
+
+		if(!GetHeader(cursor, end, 'D')) {
+			return false;
+		}
+
+		while(cursor < end) {
+			uint64_t gap, length;
+			if(!GetVarint(cursor, end, gap) || !GetVarint(cursor, end, length)
+				|| gap > n_words - position || length > n_words - position - gap || size_t(end - cursor) / 8 < length) {
+				return false;
+			}
+			position += gap;
+
+			if(apply) {
+				GetWords(cursor, end, qht.data() + position, length);
+			} else {
+				cursor += 8 * length;
+			}
+			position += length;
+		}
+	}
+
+	return true;
+}
+
+template <class T, class HashPolicy> ByteBuffer QHTFilter<T, HashPolicy>::Snapshot(const bool compressed) const {
+	/**
+	 * Encodes the content of the filter, to be persisted or shipped and loaded back with Restore.
+	 * The snapshot is a header (see PutHeader) followed by the words of the packed storage, either
+	 * as is or compressed (see PutCompressedWords). Compression is worth it while the filter is
+	 * sparse (e.g. early in a window) or has low entropy (e.g. 1-bit fingerprints).
+	 *
+	 * @param compressed
+	 * @returns the snapshot
+	 */
+	ByteBuffer snapshot;
+	PutHeader(snapshot, compressed ? 'Z' : 'S');
+
+	if(compressed) {
+		PutCompressedWords(snapshot, qht.data(), qht.size());
+	} else {
+		PutWords(snapshot, qht.data(), qht.size());
+	}
+
+	return snapshot;
+}
+
+template <class T, class HashPolicy> bool QHTFilter<T, HashPolicy>::Restore(const ByteBuffer& snapshot) {
+	/**
+	 * Loads a snapshot made by Snapshot (compressed or not) on a filter with the same geometry.
+	 * The snapshot is validated before anything is written.
+	 *
+	 * @param snapshot
+	 * @returns false (and leaves the filter untouched) if the snapshot is malformed or was made for another geometry
+	 */
+	const uint8_t* cursor = snapshot.data();
+	const uint8_t* end = cursor + snapshot.size();
+
+	if(GetHeader(cursor, end, 'S')) {
+		return size_t(end - cursor) == 8 * qht.size() && GetWords(cursor, end, qht.data(), qht.size());
+	}
+
+	cursor = snapshot.data();
+	if(!GetHeader(cursor, end, 'Z')) {
+		return false;
+	}
+
+	auto words = cursor;
+	if(!GetCompressedWords(cursor, end, nullptr, qht.size()) || cursor != end) {
+		return false;
+	}
+
+	return GetCompressedWords(words, end, qht.data(), qht.size());
+}
+
+template <class T, class HashPolicy> QHTStats QHTFilter<T, HashPolicy>::Stats() const {
+	/**
+	 * Counters since the construction of the filter or the last ResetStats.
+	 * They are only maintained when QHT_ENABLE_STATS is defined, and are all zero otherwise.
+	 * Merges, restores and deltas are not counted.
+	 */
+	return counters.Get();
+}
+
+template <class T, class HashPolicy> void QHTFilter<T, HashPolicy>::ResetStats() {
+	counters = QHTCounters();
+}
+
+template <class T, class HashPolicy> double QHTFilter<T, HashPolicy>::Occupancy(const double sampled_fraction) const {
+	/**
+	 * Proportion of non-empty buckets, computed with a word-level scan of the packed storage
+	 * (see FieldScanner). It is always available, whether QHT_ENABLE_STATS is defined or not.
+	 *
+	 * @param sampled_fraction: in ]0, 1], proportion of the filter to scan. When lower than 1, evenly spread
+	 *        blocks of 64 words are scanned, which gives an estimate at a fraction of the cost.
+	 * @returns the occupancy, between 0 and 1
+	 */
+	assert(sampled_fraction > 0 && sampled_fraction <= 1);
+
+	const size_t n_bits = n_cells * n_buckets * fingerprint_size;
+	const size_t n_words = qht.size();
+	const size_t block_words = 64;
+	const size_t stride = sampled_fraction >= 1 ? block_words : size_t(block_words / sampled_fraction);
+
+	FieldScanner scanner(fingerprint_size);
+	size_t non_empty = 0;
+	size_t scanned = 0;
+
+	for(size_t begin = 0; begin < n_words; begin += stride) {
+		auto end = std::min(n_words, begin + block_words);
+		non_empty += scanner.CountNonZero(qht.data(), n_words, begin, end);
+		scanned += scanner.CountFields(n_bits, begin, end);
+	}
+
+	return scanned == 0 ? 0. : double(non_empty) / double(scanned);
 }
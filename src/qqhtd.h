@@ -2,40 +2,150 @@
 
 #include "qht.h"
 
-template <class T> struct QQHTDFilter : QHTFilter<T> {
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct QQHTDFilter : QHTFilter<T, HashPolicy> {
 
 public:
 	QQHTDFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size);
-	bool Insert(const T& e);
+	bool Insert(const T& e) { return InsertKey(e); }
+	bool Stream(const T& e) { return StreamKey(e); }
+	bool Delete(const T& e) { return DeleteKey(e); }
+	void Merge(const QQHTDFilter& other, const size_t n_threads = 1);
+
+	// Same operations on the bytes of a key (see KeyBytes) or its hashes (see Prehash), Lookup is inherited
+	bool Insert(const std::string_view bytes) { return InsertKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Stream(const std::string_view bytes) { return StreamKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Delete(const std::string_view bytes) { return DeleteKey(KeyBytes{bytes.data(), bytes.size()}); }
+	template <class C, IfCString<C> = 0> bool Insert(const C* bytes) { return Insert(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Delete(const C* bytes) { return Delete(std::string_view(bytes)); }
+	bool Insert(const void* data, const size_t size) { return InsertKey(KeyBytes{data, size}); }
+	bool Stream(const void* data, const size_t size) { return StreamKey(KeyBytes{data, size}); }
+	bool Delete(const void* data, const size_t size) { return DeleteKey(KeyBytes{data, size}); }
+	bool InsertHandle(const KeyHandle& handle) { return InsertKey(handle); }
+	bool StreamHandle(const KeyHandle& handle) { return StreamKey(handle); }
+	bool DeleteHandle(const KeyHandle& handle) { return DeleteKey(handle); }
+	bool StreamParts(const std::initializer_list<KeyBytes> parts) { return StreamKey(this->PrehashParts(parts)); }
+	template <class... Fields> bool StreamFields(const Fields&... fields) { return StreamKey(this->PrehashFields(fields...)); }
+#if QHT_IOVEC
+	bool StreamParts(const iovec* ranges, const size_t count) { return StreamKey(this->PrehashParts(ranges, count)); }
+#endif
+	void StreamBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return StreamKey(handle); });
+	}
 
 protected:
+	template <class K> bool InsertKey(const K& e);
+	template <class K> bool StreamKey(const K& e);
+	template <class K> bool DeleteKey(const K& e);
 	bool InsertFingerprintInLastBucket(const size_t address, const uint64_t fingerprint);
+	bool RemoveFromQueue(const uint64_t address, const uint64_t fingerprint);
 };
 
-template <class T> QQHTDFilter<T>::QQHTDFilter(
+template <class T, class HashPolicy> QQHTDFilter<T, HashPolicy>::QQHTDFilter(
 	const uint64_t memory_size,
 	const size_t n_n_buckets,
 	const size_t n_fingerprint_size
-) : QHTFilter<T>(memory_size, n_n_buckets, n_fingerprint_size) {
+) : QHTFilter<T, HashPolicy>(memory_size, n_n_buckets, n_fingerprint_size) {
 }
 
-template <class T> bool QQHTDFilter<T>::Insert(const T& e) {
+template <class T, class HashPolicy> template <class K> bool QQHTDFilter<T, HashPolicy>::InsertKey(const K& e) {
 	/**
 	 * Inserts element e in the filter
 	 * @param e
 	 * @return bool : true if e is detected as a duplicate, false otherwise
 	 */
-	auto detected = this->Lookup(e);
+	auto detected = this->LookupKey(e);
 
-	auto address = this->Address(e);
-	auto fingerprint = this->Fingerprint(e);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	auto fingerprint = this->Fingerprint(key);
 
 	InsertFingerprintInLastBucket(address, fingerprint);
 
 	return true;
 }
 
-template <class T> bool QQHTDFilter<T>::InsertFingerprintInLastBucket(const size_t address, const uint64_t fingerprint) {
+template <class T, class HashPolicy> template <class K> bool QQHTDFilter<T, HashPolicy>::StreamKey(const K& e) {
+	/**
+	 * Inserts element e at the end of the queue of its cell if not already present,
+	 * pushing out the oldest fingerprint of the cell
+	 * @param e
+	 * @return bool : true if e is detected as a duplicate, false otherwise
+	 */
+	QHT_PHASE_START(kPhaseStream);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto detected = this->InCell(address, fingerprint);
+	QHT_PHASE(kPhaseProbe);
+	if(!detected) {
+		this->CountInsertion(this->GetFingerprintFromBucket(address, 0) == 0 ? this->kEmptyBucket : this->kEviction);
+		InsertFingerprintInLastBucket(address, fingerprint);
+		QHT_PHASE(kPhaseWrite);
+	}
+	QHT_PHASE_STOP();
+
+	this->counters.streams.Increment();
+	if(detected) {
+		this->counters.duplicates.Increment();
+	}
+
+	return detected;
+}
+
+template <class T, class HashPolicy> template <class K> bool QQHTDFilter<T, HashPolicy>::DeleteKey(const K& e) {
+	/**
+	 * Deletes one copy of the fingerprint of e from the queue of its cell (see QHTFilter::Delete and RemoveFromQueue)
+	 * @returns true if the fingerprint was found (and deleted), false otherwise
+	 */
+	QHT_PHASE_START(kPhaseDelete);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto found = RemoveFromQueue(address, fingerprint);
+	QHT_PHASE_STOP();
+
+	if(found) {
+		this->counters.deletes.Increment();
+	} else {
+		this->counters.failed_deletes.Increment();
+	}
+
+	return found;
+}
+
+template <class T, class HashPolicy> bool QQHTDFilter<T, HashPolicy>::RemoveFromQueue(const uint64_t address, const uint64_t fingerprint) {
+	/**
+	 * Removes the oldest copy of a fingerprint from the queue of a cell. The fingerprints queued before it move one bucket
+	 * towards the end, so that the queue keeps its order (oldest in bucket 0, newest in the last bucket) and its empty
+	 * buckets stay at its head. QHTFilter::RemoveFromCell packs the other way, leaving the empty bucket at the end,
+	 * where the next queued fingerprint would shift it into the middle of the queue.
+	 * @returns true if the fingerprint was in the cell
+	 */
+	size_t i = 0;
+	while(i < this->n_buckets && this->GetFingerprintFromBucket(address, i) != fingerprint) {
+		++i;
+	}
+	QHT_PHASE(kPhaseProbe);
+
+	if(i == this->n_buckets) {
+		return false;
+	}
+
+	for(; i > 0; --i) {
+		this->InsertFingerprintInBucket(address, i, this->GetFingerprintFromBucket(address, i - 1));
+	}
+	this->InsertFingerprintInBucket(address, 0, 0);
+	QHT_PHASE(kPhaseWrite);
+
+	return true;
+}
+
+template <class T, class HashPolicy> bool QQHTDFilter<T, HashPolicy>::InsertFingerprintInLastBucket(const size_t address, const uint64_t fingerprint) {
 	/**
 	 * In QQHTD, buckets behave like a queue. Therefore each element is inserted at the end of the queue.
 	 * Using a linked list would require additional bits of data (for storing pointers).
@@ -54,3 +164,26 @@ template <class T> bool QQHTDFilter<T>::InsertFingerprintInLastBucket(const size
 
 	return true;
 }
+
+template <class T, class HashPolicy> void QQHTDFilter<T, HashPolicy>::Merge(const QQHTDFilter& other, const size_t n_threads) {
+	/**
+	 * Merges a compatible filter into this one, cell by cell (see QHTFilter::Merge).
+	 * Fingerprints of `other` missing from a cell are queued at its end, oldest first, pushing out the oldest ones.
+	 *
+	 * @param other: filter with the same geometry
+	 * @param n_threads: number of threads sharing the cells
+	 */
+	assert(this->Compatible(other));
+	if(&other == this) {
+		return;
+	}
+
+	this->MergeCells(other, n_threads, [this, &other](const uint64_t address, std::mt19937&) {
+		for(size_t i = 0; i < this->n_buckets; ++i) {
+			auto fingerprint = other.GetFingerprintFromBucket(address, i);
+			if(fingerprint != 0 && !this->InCell(address, fingerprint)) {
+				InsertFingerprintInLastBucket(address, fingerprint);
+			}
+		}
+	});
+}
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include <boost/functional/hash.hpp>
+
+#include "hash.h"
+#include "packed.h"
+
+/**
+ * Resizable QHT.
+ *
+ * The number of cells is a power of two and the address of an element is the low bits of Hash1.
+ * Each bucket stores, next to the fingerprint, the `quotient_size` bits of Hash1 that come right
+ * after the address bits (the "quotient"). A bucket is laid out as [quotient | fingerprint] and is
+ * empty when it contains 0, which cannot happen for a stored element since fingerprints are nonzero.
+ *
+ * Since the quotient tells which half of the hash space an element came from, the filter can be
+ * doubled (cell `a` is split into `a` and `a + n_cells`, consuming one quotient bit) or halved
+ * (cells `a` and `a + n_cells / 2` are folded into `a`, adding one quotient bit) without having
+ * access to the original elements.
+ *
+ * Resizing can be done at once (Grow, Shrink) or incrementally (StartGrow, StartShrink), in which
+ * case every subsequent operation migrates a few cells until the migration is over.
+ * The cells are not resized in place: a bucket loses (or gains) a quotient bit, which changes the layout of
+ * every cell, so the new geometry is filled into a second table and the old one is freed at the end.
+ * While a resize runs, both tables are allocated: a little under 3 times the memory of the filter when growing
+ * (the new table has twice the cells, each bucket one bit shorter) and a little over 1.5 times when shrinking.
+ */
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct RQHTFilter {
+
+protected:
+	/** A table with its own geometry, the filter holds one, or two while migrating */
+	struct Table {
+		size_t log_cells = 0;
+		size_t quotient_size = 0;
+		PackedBits bits = {};
+	};
+
+	size_t n_buckets;
+	size_t fingerprint_size;
+
+	std::mt19937 rng;
+	std::uniform_int_distribution<size_t> bucket_selector;
+
+	Table current;
+
+	// Migration state: `next` is the table being filled, pairs below `migration_cursor` have been moved
+	bool migrating;
+	Table next;
+	size_t migration_cursor;
+	size_t migration_step;
+
+	template <class K> uint64_t Fingerprint(const K& e) const;
+	size_t BucketSize(const Table& table) const;
+	uint64_t GetBucket(const Table& table, const size_t address, const size_t bucket_number) const;
+	void SetBucket(Table& table, const size_t address, const size_t bucket_number, const uint64_t value);
+	bool InsertInCell(Table& table, const size_t address, const uint64_t value);
+	std::pair<Table*, size_t> Locate(const HashValue hash, uint64_t& value);
+	void MigratePair(const size_t pair);
+	void StartMigration(const size_t log_cells, const size_t quotient_size, const size_t cells_per_operation);
+
+public:
+	RQHTFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size, const size_t n_quotient_size);
+	bool Lookup(const T& e);
+	bool Insert(const T& e);
+	bool Stream(const T& e);
+	bool Delete(const T& e);
+	void Reset();
+
+	void Grow();
+	void Shrink();
+	void StartGrow(const size_t cells_per_operation);
+	void StartShrink(const size_t cells_per_operation);
+	bool Migrate(const size_t n_pairs);
+	bool Migrating() const;
+
+	size_t Cells() const;
+	size_t QuotientSize() const;
+};
+
+template <class T, class HashPolicy> RQHTFilter<T, HashPolicy>::RQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_n_buckets,
+	const size_t n_fingerprint_size,
+	const size_t n_quotient_size
+) : n_buckets(n_n_buckets), fingerprint_size(n_fingerprint_size), rng(), bucket_selector(0, n_n_buckets - 1),
+    current(), migrating(false), next(), migration_cursor(0), migration_step(0)
+{
+	/**
+	 * The number of cells is rounded down to a power of two, so that the filter uses at most memory_size bits
+	 * @param memory_size: maximum number of bits used by the filter
+	 * @param n_n_buckets: number of buckets per cell
+	 * @param n_fingerprint_size: number of bits of a fingerprint
+	 * @param n_quotient_size: number of extra bits of Hash1 stored in each bucket, i.e. how many times the filter can be doubled
+	 */
+	assert(n_buckets > 0);
+	assert(fingerprint_size > 0);
+	assert(fingerprint_size + n_quotient_size < 64); // Buckets are handled as uint64_t
+
+	auto max_cells = memory_size / (n_buckets * (fingerprint_size + n_quotient_size));
+	assert(max_cells > 0);
+
+	current.log_cells = 0;
+	while((uint64_t(2) << current.log_cells) <= max_cells) {
+		++current.log_cells;
+	}
+	current.quotient_size = n_quotient_size;
+
+	Reset();
+}
+
+template <class T, class HashPolicy> template <class K> uint64_t RQHTFilter<T, HashPolicy>::Fingerprint(const K& e) const {
+	/** Get the fingerprint of an element, same construction as QHTFilter::Fingerprint
+	 * @param e the element or its handle
+	 * @return nonzero fingerprint of e
+	 */
+	HashValue hash = PolicyHash2<HashPolicy>(e);
+	const uint64_t mask = (uint64_t(1) << fingerprint_size) - 1;
+
+	uint64_t fingerprint = hash & mask;
+
+	int adder = 0;
+	while(fingerprint == 0) {
+		boost::hash_combine(hash, hash + ++adder);
+		fingerprint = hash & mask;
+	}
+
+	return fingerprint;
+}
+
+template <class T, class HashPolicy> size_t RQHTFilter<T, HashPolicy>::BucketSize(const Table& table) const {
+	return table.quotient_size + fingerprint_size;
+}
+
+template <class T, class HashPolicy> uint64_t RQHTFilter<T, HashPolicy>::GetBucket(const Table& table, const size_t address, const size_t bucket_number) const {
+	/**
+	 * Same layout as QHTFilter: buckets of a cell are consecutive, most significant bit first
+	 * @param table: table to read from
+	 * @param address: cell in the table
+	 * @param bucket_number: bucket in the cell
+	 * @returns the [quotient | fingerprint] value of the bucket, 0 if empty
+	 */
+	auto bucket_size = BucketSize(table);
+	auto offset = (address * n_buckets + bucket_number) * bucket_size;
+
+	return ReadBits(table.bits.data(), offset, bucket_size);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::SetBucket(Table& table, const size_t address, const size_t bucket_number, const uint64_t value) {
+	auto bucket_size = BucketSize(table);
+	auto offset = (address * n_buckets + bucket_number) * bucket_size;
+
+	WriteBits(table.bits.data(), offset, bucket_size, value);
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::InsertInCell(Table& table, const size_t address, const uint64_t value) {
+	/**
+	 * Inserts value in the cell if not already present: in the first empty bucket, or in a random one if the cell is full.
+	 * Buckets of a cell are filled from left to right.
+	 * @returns true if the value was already present in the cell
+	 */
+	size_t bucket_number = 0;
+	for(; bucket_number < n_buckets; ++bucket_number) {
+		auto current_value = GetBucket(table, address, bucket_number);
+
+		if(current_value == value) {
+			return true;
+		}
+		if(current_value == 0) {
+			break;
+		}
+	}
+
+	if(bucket_number == n_buckets) {
+		bucket_number = bucket_selector(rng);
+	}
+
+	SetBucket(table, address, bucket_number, value);
+
+	return false;
+}
+
+template <class T, class HashPolicy> std::pair<typename RQHTFilter<T, HashPolicy>::Table*, size_t> RQHTFilter<T, HashPolicy>::Locate(const HashValue hash, uint64_t& value) {
+	/**
+	 * Finds the table and the cell in which an element currently lives
+	 * While migrating, pairs of sibling cells below `migration_cursor` have already been moved to `next`.
+	 *
+	 * @param hash: Hash1 of the element
+	 * @param value: output, fingerprint of the element on input, [quotient | fingerprint] on output
+	 * @returns the table and the address of the cell
+	 */
+	Table* table = &current;
+
+	if(migrating) {
+		auto pair = hash & ((size_t(1) << std::min(current.log_cells, next.log_cells)) - 1);
+		if(pair < migration_cursor) {
+			table = &next;
+		}
+	}
+
+	auto address = hash & ((size_t(1) << table->log_cells) - 1);
+	auto quotient = (hash >> table->log_cells) & ((uint64_t(1) << table->quotient_size) - 1);
+
+	value |= quotient << fingerprint_size;
+
+	return {table, address};
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Lookup(const T& e) {
+	/** Returns true if the element e is detected inside the filter
+	 * @param e
+	 * @returns boolean
+	 */
+	Migrate(migration_step);
+
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto value = Fingerprint(key);
+	auto location = Locate(PolicyHash1<HashPolicy>(key), value);
+
+	for(size_t i = 0; i < n_buckets; ++i) {
+		if(GetBucket(*location.first, location.second, i) == value) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Insert(const T& e) {
+	/** Inserts element e in the filter if not already present
+	 * @param e
+	 * @returns true
+	 */
+	Stream(e);
+
+	return true;
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Stream(const T& e) {
+	/** Inserts element e in the filter if not already present
+	 * @param e
+	 * @returns boolean being true if the element was already in the filter, false otherwise
+	 */
+	Migrate(migration_step);
+
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto value = Fingerprint(key);
+	auto location = Locate(PolicyHash1<HashPolicy>(key), value);
+
+	return InsertInCell(*location.first, location.second, value);
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Delete(const T& e) {
+	/**
+	 * Deletes an element e from the filter, see QHTFilter::Delete for the caveats
+	 * @param e: the element to remove from the filter
+	 * @returns bool: true if the element, or a false duplicate, is found (and deleted),
+	 *                false if no such element is found.
+	 */
+	Migrate(migration_step);
+
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto value = Fingerprint(key);
+	auto location = Locate(PolicyHash1<HashPolicy>(key), value);
+	auto& table = *location.first;
+	auto address = location.second;
+
+	size_t i = 0;
+	while(i < n_buckets && GetBucket(table, address, i) != value) {
+		++i;
+	}
+
+	if(i == n_buckets) {
+		return false;
+	}
+
+	// Keep the buckets packed to the left
+	for(; i < n_buckets - 1; ++i) {
+		SetBucket(table, address, i, GetBucket(table, address, i + 1));
+	}
+
+	SetBucket(table, address, n_buckets - 1, 0);
+
+	return true;
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::Reset() {
+	/**
+	 * Re-set all cells to 0 (Empty), aborting any ongoing migration.
+	 * The filter keeps its current size.
+	 */
+	migrating = false;
+	migration_cursor = 0;
+	next.bits = PackedBits();
+
+	current.bits.assign(PackedWords((size_t(1) << current.log_cells) * n_buckets * BucketSize(current)), 0);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::StartMigration(const size_t log_cells, const size_t quotient_size, const size_t cells_per_operation) {
+	assert(!migrating);
+
+	next.log_cells = log_cells;
+	next.quotient_size = quotient_size;
+	next.bits.assign(PackedWords((size_t(1) << log_cells) * n_buckets * BucketSize(next)), 0);
+
+	migrating = true;
+	migration_cursor = 0;
+	migration_step = cells_per_operation;
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::StartGrow(const size_t cells_per_operation) {
+	/**
+	 * Starts doubling the number of cells. Every following operation migrates `cells_per_operation` cells
+	 * of the current table. Requires at least one quotient bit. The new table is allocated right away
+	 * (see the memory note of the class).
+	 * @param cells_per_operation: 0 means that cells are only migrated by explicit calls to Migrate
+	 */
+	// A new resize can only start once the previous one is over, from the geometry it leads to
+	Migrate(SIZE_MAX);
+	assert(current.quotient_size > 0);
+
+	StartMigration(current.log_cells + 1, current.quotient_size - 1, cells_per_operation);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::StartShrink(const size_t cells_per_operation) {
+	/**
+	 * Starts halving the number of cells. Every following operation migrates `cells_per_operation` pairs
+	 * of sibling cells. When both siblings together hold more than n_buckets fingerprints, the
+	 * overflowing ones are evicted as if they had been streamed into a full cell.
+	 * @param cells_per_operation: 0 means that cells are only migrated by explicit calls to Migrate
+	 */
+	Migrate(SIZE_MAX);
+	assert(current.log_cells > 0);
+	assert(current.quotient_size + fingerprint_size + 1 < 64);
+
+	StartMigration(current.log_cells - 1, current.quotient_size + 1, cells_per_operation);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::Grow() {
+	/** Doubles the number of cells at once */
+	StartGrow(0);
+	Migrate(size_t(1) << current.log_cells);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::Shrink() {
+	/** Halves the number of cells at once */
+	StartShrink(0);
+	Migrate(size_t(1) << current.log_cells);
+}
+
+template <class T, class HashPolicy> void RQHTFilter<T, HashPolicy>::MigratePair(const size_t pair) {
+	/**
+	 * Moves a pair of sibling cells to `next`.
+	 * Growing: cell `pair` of `current` is split into cells `pair` and `pair + n_cells` of `next`,
+	 *          according to the lowest quotient bit.
+	 * Shrinking: cells `pair` and `pair + n_cells / 2` of `current` are folded into cell `pair` of `next`,
+	 *            the origin becoming the lowest quotient bit.
+	 * @param pair: index of the pair, lower than the number of cells of the smallest table
+	 */
+	const uint64_t fingerprint_mask = (uint64_t(1) << fingerprint_size) - 1;
+
+	if(next.log_cells > current.log_cells) {
+		size_t filled[2] = {0, 0};
+
+		for(size_t i = 0; i < n_buckets; ++i) {
+			auto value = GetBucket(current, pair, i);
+			if(value == 0) {
+				break;
+			}
+
+			auto quotient = value >> fingerprint_size;
+			auto half = quotient & 0b1;
+			auto new_value = ((quotient >> 1) << fingerprint_size) | (value & fingerprint_mask);
+
+			SetBucket(next, pair + (half << current.log_cells), filled[half]++, new_value);
+		}
+	} else {
+		for(size_t half = 0; half < 2; ++half) {
+			auto address = pair + (half << next.log_cells);
+
+			for(size_t i = 0; i < n_buckets; ++i) {
+				auto value = GetBucket(current, address, i);
+				if(value == 0) {
+					break;
+				}
+
+				auto quotient = ((value >> fingerprint_size) << 1) | half;
+				InsertInCell(next, pair, (quotient << fingerprint_size) | (value & fingerprint_mask));
+			}
+		}
+	}
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Migrate(const size_t n_pairs) {
+	/**
+	 * Moves up to n_pairs pairs of sibling cells to the resized table.
+	 * When all of them are moved, the resized table replaces the current one.
+	 * @param n_pairs: number of pairs to move
+	 * @returns true if no migration is ongoing anymore
+	 */
+	if(!migrating) {
+		return true;
+	}
+
+	const size_t n_pairs_total = size_t(1) << std::min(current.log_cells, next.log_cells);
+
+	for(size_t i = 0; i < n_pairs && migration_cursor < n_pairs_total; ++i) {
+		MigratePair(migration_cursor++);
+	}
+
+	if(migration_cursor < n_pairs_total) {
+		return false;
+	}
+
+	std::swap(current, next);
+	next.bits = PackedBits();
+	migrating = false;
+	migration_cursor = 0;
+	migration_step = 0;
+
+	return true;
+}
+
+template <class T, class HashPolicy> bool RQHTFilter<T, HashPolicy>::Migrating() const {
+	return migrating;
+}
+
+template <class T, class HashPolicy> size_t RQHTFilter<T, HashPolicy>::Cells() const {
+	/** @returns the number of cells of the filter, once the ongoing migration (if any) is over */
+	return size_t(1) << (migrating ? next.log_cells : current.log_cells);
+}
+
+template <class T, class HashPolicy> size_t RQHTFilter<T, HashPolicy>::QuotientSize() const {
+	/** @returns the number of quotient bits per bucket, i.e. how many more times the filter can be doubled */
+	return migrating ? next.quotient_size : current.quotient_size;
+}
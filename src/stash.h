@@ -0,0 +1,314 @@
+#pragma once
+
+#include "qht.h"
+
+struct OverflowStash {
+	/**
+	 * Small fixed-size array of fingerprints evicted from full cells, each tagged with its cell: tag = (address <<
+	 * fingerprint_size) | fingerprint, never 0 as fingerprints are nonzero (0 marks an empty entry). Tags of two
+	 * cells only collide when the number of cells times 2^fingerprint_size exceeds 2^64.
+	 * A few hundred entries fit in L1/L2 and are probed all at once with vector compares (see ContainsWord).
+	 * The stash is a FIFO ring: a new tag overwrites the oldest entry, whether it was hit since or not.
+	 *
+	 * Most probes are for cells with nothing in the stash: a count of entries per group of cells (8 groups per entry,
+	 * 2 bytes each) answers them with a single load.
+	 */
+	size_t fingerprint_size;
+	std::vector<uint64_t> tags;
+	std::vector<uint16_t> counts;
+	size_t next;
+
+	OverflowStash(const size_t n_entries, const size_t n_fingerprint_size)
+		: fingerprint_size(n_fingerprint_size), tags(Entries(n_entries), 0), counts(Groups(n_entries), 0), next(0) {
+		assert(n_entries <= 0xffff); // A group count could reach the number of entries
+	}
+
+	static size_t Entries(const size_t n_entries) { return std::max(size_t(1), n_entries); }
+
+	static size_t Groups(const size_t n_entries) {
+		size_t n_groups = 1;
+		while(n_groups < 8 * Entries(n_entries)) {
+			n_groups *= 2;
+		}
+		return n_groups;
+	}
+
+	static uint64_t MemoryBits(const size_t n_entries) {
+		/** @returns the memory of a stash of n_entries entries, tags and counts: 6 KB for 256 entries */
+		return 8 * (sizeof(uint64_t) * Entries(n_entries) + sizeof(uint16_t) * Groups(n_entries));
+	}
+
+	uint64_t Tag(const uint64_t address, const uint64_t fingerprint) const { return (address << fingerprint_size) | fingerprint; }
+	uint16_t& Count(const uint64_t tag) { return counts[(tag >> fingerprint_size) & (counts.size() - 1)]; }
+
+	bool Contains(const uint64_t tag) const {
+		if(counts[(tag >> fingerprint_size) & (counts.size() - 1)] == 0) {
+			return false;
+		}
+		return ContainsWord(tags.data(), tags.size(), tag);
+	}
+
+	bool Contains(const uint64_t address, const uint64_t fingerprint) const { return Contains(Tag(address, fingerprint)); }
+
+	void Push(const uint64_t tag) {
+		if(tags[next] != 0) {
+			--Count(tags[next]);
+		}
+		tags[next] = tag;
+		++Count(tag);
+		next = (next + 1) % tags.size();
+	}
+
+	void Push(const uint64_t address, const uint64_t fingerprint) { Push(Tag(address, fingerprint)); }
+
+	bool Remove(const uint64_t address, const uint64_t fingerprint) {
+		/** @returns true if the fingerprint was in the stash for this cell (one copy is cleared) */
+		auto tag = Tag(address, fingerprint);
+		if(!Contains(tag)) {
+			return false;
+		}
+
+		*std::find(tags.begin(), tags.end(), tag) = 0;
+		--Count(tag);
+		return true;
+	}
+
+	void Clear() {
+		std::fill(tags.begin(), tags.end(), 0);
+		std::fill(counts.begin(), counts.end(), 0);
+		next = 0;
+	}
+};
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct StashedQHTFilter : QHTFilter<T, HashPolicy> {
+	/**
+	 * QHT backed by an overflow stash (see OverflowStash): the fingerprint evicted from a full cell moves to the stash
+	 * instead of being dropped, so that a burst of keys on a few hot cells does not flush them. The stash is only
+	 * probed when the cell of a key misses, and a fingerprint found there counts as a duplicate (it stays in the stash).
+	 *
+	 * The stash comes on top of memory_size (see OverflowStash::MemoryBits) and is merged by Merge, but it is not part of
+	 * Diff, Snapshot and Occupancy, which only cover the cells. Restore and ApplyDelta replace the cells and empty
+	 * the stash, whose entries were evicted from the previous contents.
+	 */
+
+protected:
+	OverflowStash stash;
+
+	typename QHTFilter<T, HashPolicy>::Insertion InsertWithStash(const uint64_t address, const uint64_t fingerprint);
+	template <class K> bool LookupKey(const K& e);
+	template <class K> bool InsertKey(const K& e);
+	template <class K> bool StreamKey(const K& e);
+	template <class K> bool DeleteKey(const K& e);
+
+public:
+	StashedQHTFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size, const size_t n_stash_entries = 256);
+	bool Lookup(const T& e) { return LookupKey(e); }
+	bool Insert(const T& e) { return InsertKey(e); }
+	bool Stream(const T& e) { return StreamKey(e); }
+	bool Delete(const T& e) { return DeleteKey(e); }
+	void Reset();
+	void Merge(const StashedQHTFilter& other, const size_t n_threads = 1);
+	bool ApplyDelta(const ByteBuffer& delta);
+	bool Restore(const ByteBuffer& snapshot);
+
+	// Same operations on the bytes of a key (see KeyBytes), its hashes (see Prehash) or its parts (see PrehashParts)
+	bool Lookup(const std::string_view bytes) { return LookupKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Insert(const std::string_view bytes) { return InsertKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Stream(const std::string_view bytes) { return StreamKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Delete(const std::string_view bytes) { return DeleteKey(KeyBytes{bytes.data(), bytes.size()}); }
+	template <class C, IfCString<C> = 0> bool Lookup(const C* bytes) { return Lookup(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Insert(const C* bytes) { return Insert(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Delete(const C* bytes) { return Delete(std::string_view(bytes)); }
+	bool Lookup(const void* data, const size_t size) { return LookupKey(KeyBytes{data, size}); }
+	bool Insert(const void* data, const size_t size) { return InsertKey(KeyBytes{data, size}); }
+	bool Stream(const void* data, const size_t size) { return StreamKey(KeyBytes{data, size}); }
+	bool Delete(const void* data, const size_t size) { return DeleteKey(KeyBytes{data, size}); }
+	bool LookupHandle(const KeyHandle& handle) { return LookupKey(handle); }
+	bool InsertHandle(const KeyHandle& handle) { return InsertKey(handle); }
+	bool StreamHandle(const KeyHandle& handle) { return StreamKey(handle); }
+	bool DeleteHandle(const KeyHandle& handle) { return DeleteKey(handle); }
+	bool LookupParts(const std::initializer_list<KeyBytes> parts) { return LookupKey(this->PrehashParts(parts)); }
+	bool StreamParts(const std::initializer_list<KeyBytes> parts) { return StreamKey(this->PrehashParts(parts)); }
+	template <class... Fields> bool LookupFields(const Fields&... fields) { return LookupKey(this->PrehashFields(fields...)); }
+	template <class... Fields> bool StreamFields(const Fields&... fields) { return StreamKey(this->PrehashFields(fields...)); }
+#if QHT_IOVEC
+	bool LookupParts(const iovec* ranges, const size_t count) { return LookupKey(this->PrehashParts(ranges, count)); }
+	bool StreamParts(const iovec* ranges, const size_t count) { return StreamKey(this->PrehashParts(ranges, count)); }
+#endif
+
+	void LookupBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return LookupKey(handle); });
+	}
+	void StreamBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { return StreamKey(handle); });
+	}
+
+	size_t StashEntries() const { return stash.tags.size(); }
+};
+
+template <class T, class HashPolicy> StashedQHTFilter<T, HashPolicy>::StashedQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_n_buckets,
+	const size_t n_fingerprint_size,
+	const size_t n_stash_entries
+) : QHTFilter<T, HashPolicy>(memory_size, n_n_buckets, n_fingerprint_size), stash(n_stash_entries, n_fingerprint_size) {
+	/**
+	 * @param n_stash_entries: number of fingerprints the stash holds (at most 65535), a few hundred keep it in cache
+	 */
+}
+
+template <class T, class HashPolicy> typename QHTFilter<T, HashPolicy>::Insertion StashedQHTFilter<T, HashPolicy>::InsertWithStash(
+	const uint64_t address,
+	const uint64_t fingerprint
+) {
+	/**
+	 * Same policy as QHTFilter::InsertInCell, except that a fingerprint in the stash is present too,
+	 * and that the fingerprint evicted from a full cell is pushed to the stash
+	 * @returns kPresent if the fingerprint was already in the cell or in the stash, otherwise where it was inserted
+	 */
+	size_t empty_bucket = this->n_buckets;
+	for(size_t bucket_number = 0; bucket_number < this->n_buckets; ++bucket_number) {
+		auto current_fingerprint = this->GetFingerprintFromBucket(address, bucket_number);
+
+		if(current_fingerprint == fingerprint) {
+			QHT_PHASE(kPhaseProbe);
+			return this->kPresent;
+		}
+		if(current_fingerprint == 0 && empty_bucket == this->n_buckets) {
+			empty_bucket = bucket_number;
+		}
+	}
+	if(stash.Contains(address, fingerprint)) {
+		QHT_PHASE(kPhaseProbe);
+		return this->kPresent;
+	}
+	QHT_PHASE(kPhaseProbe);
+
+	auto insertion = this->kEmptyBucket;
+	if(empty_bucket == this->n_buckets) {
+		empty_bucket = std::uniform_int_distribution<size_t>(0, this->n_buckets - 1)(this->rng);
+		stash.Push(address, this->GetFingerprintFromBucket(address, empty_bucket));
+		insertion = this->kEviction;
+	}
+
+	this->InsertFingerprintInBucket(address, empty_bucket, fingerprint);
+	QHT_PHASE(kPhaseWrite);
+
+	return insertion;
+}
+
+template <class T, class HashPolicy> template <class K> bool StashedQHTFilter<T, HashPolicy>::LookupKey(const K& e) {
+	/** @returns true if the fingerprint of e is in its cell or, failing that, in the stash */
+	QHT_PHASE_START(kPhaseLookup);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto found = this->InCell(address, fingerprint) || stash.Contains(address, fingerprint);
+	QHT_PHASE(kPhaseProbe);
+	QHT_PHASE_STOP();
+
+	return found;
+}
+
+template <class T, class HashPolicy> template <class K> bool StashedQHTFilter<T, HashPolicy>::InsertKey(const K& e) {
+	/**
+	 * Inserts element e in the filter if not already present
+	 * @returns true
+	 */
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	auto fingerprint = this->Fingerprint(key);
+
+	this->CountInsertion(InsertWithStash(address, fingerprint));
+
+	return true;
+}
+
+template <class T, class HashPolicy> template <class K> bool StashedQHTFilter<T, HashPolicy>::StreamKey(const K& e) {
+	/**
+	 * Inserts element e in the filter if it is neither in its cell nor in the stash
+	 * @returns true if the element was already in the filter, false otherwise
+	 */
+	QHT_PHASE_START(kPhaseStream);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto detected = this->CountInsertion(InsertWithStash(address, fingerprint));
+	QHT_PHASE_STOP();
+
+	this->counters.streams.Increment();
+	if(detected) {
+		this->counters.duplicates.Increment();
+	}
+
+	return detected;
+}
+
+template <class T, class HashPolicy> template <class K> bool StashedQHTFilter<T, HashPolicy>::DeleteKey(const K& e) {
+	/**
+	 * Deletes one copy of the fingerprint of e from its cell or, failing that, from the stash (see QHTFilter::Delete)
+	 * @returns true if the fingerprint was found (and deleted), false otherwise
+	 */
+	QHT_PHASE_START(kPhaseDelete);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto address = this->Address(key);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto found = this->RemoveFromCell(address, fingerprint) || stash.Remove(address, fingerprint);
+	QHT_PHASE_STOP();
+
+	if(found) {
+		this->counters.deletes.Increment();
+	} else {
+		this->counters.failed_deletes.Increment();
+	}
+
+	return found;
+}
+
+template <class T, class HashPolicy> void StashedQHTFilter<T, HashPolicy>::Reset() {
+	QHTFilter<T, HashPolicy>::Reset();
+	stash.Clear();
+}
+
+template <class T, class HashPolicy> void StashedQHTFilter<T, HashPolicy>::Merge(const StashedQHTFilter& other, const size_t n_threads) {
+	/**
+	 * Merges the cells of a compatible filter (see QHTFilter::Merge, the fingerprints it evicts are dropped),
+	 * then pushes the entries of its stash that are missing from this one, oldest first
+	 */
+	QHTFilter<T, HashPolicy>::Merge(other, n_threads);
+	if(&other == this) {
+		return;
+	}
+
+	for(size_t i = 0; i < other.stash.tags.size(); ++i) {
+		auto tag = other.stash.tags[(other.stash.next + i) % other.stash.tags.size()];
+		if(tag != 0 && !stash.Contains(tag)) {
+			stash.Push(tag);
+		}
+	}
+}
+
+template <class T, class HashPolicy> bool StashedQHTFilter<T, HashPolicy>::ApplyDelta(const ByteBuffer& delta) {
+	/** See QHTFilter::ApplyDelta, the stash is emptied if the delta is applied */
+	if(!QHTFilter<T, HashPolicy>::ApplyDelta(delta)) {
+		return false;
+	}
+	stash.Clear();
+	return true;
+}
+
+template <class T, class HashPolicy> bool StashedQHTFilter<T, HashPolicy>::Restore(const ByteBuffer& snapshot) {
+	/** See QHTFilter::Restore, the stash is emptied if the snapshot is restored */
+	if(!QHTFilter<T, HashPolicy>::Restore(snapshot)) {
+		return false;
+	}
+	stash.Clear();
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Runtime statistics of a filter.
+ *
+ * Counters are only maintained when QHT_ENABLE_STATS is defined (e.g. -DQHT_ENABLE_STATS), otherwise
+ * they compile to nothing and Stats() reports zeros.
+ * A filter is written by a single thread, so counters are relaxed atomics updated with a plain load and
+ * store (no locked instruction): other threads can read them at any time without tearing.
+ */
+
+/** Values of the counters of a filter at a given time */
+struct QHTStats {
+	uint64_t streams = 0;          // Calls to Stream
+	uint64_t duplicates = 0;       // Calls to Stream detecting the element
+	uint64_t empty_inserts = 0;    // Insertions in an empty bucket (Stream, Insert)
+	uint64_t evictions = 0;        // Insertions in a full cell, erasing a fingerprint (Stream, Insert)
+	uint64_t deletes = 0;          // Calls to Delete finding the element
+	uint64_t failed_deletes = 0;   // Calls to Delete not finding the element
+
+	double HitRate() const {
+		/** @returns the proportion of streamed elements detected as duplicates */
+		return streams == 0 ? 0. : double(duplicates) / double(streams);
+	}
+};
+
+#ifdef QHT_ENABLE_STATS
+
+struct StatCounter {
+	std::atomic<uint64_t> value;
+
+	StatCounter() : value(0) {}
+	StatCounter(const StatCounter& other) : value(other.Get()) {}
+	StatCounter& operator=(const StatCounter& other) {
+		value.store(other.Get(), std::memory_order_relaxed);
+		return *this;
+	}
+
+	void Increment() {
+		// Single writer: no need for an atomic read-modify-write
+		value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	uint64_t Get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+};
+
+#else
+
+struct StatCounter {
+	void Increment() {}
+	uint64_t Get() const { return 0; }
+};
+
+#endif
+
+struct QHTCounters {
+	StatCounter streams = {};
+	StatCounter duplicates = {};
+	StatCounter empty_inserts = {};
+	StatCounter evictions = {};
+	StatCounter deletes = {};
+	StatCounter failed_deletes = {};
+
+	QHTStats Get() const {
+		QHTStats stats;
+		stats.streams = streams.Get();
+		stats.duplicates = duplicates.Get();
+		stats.empty_inserts = empty_inserts.Get();
+		stats.evictions = evictions.Get();
+		stats.deletes = deletes.Get();
+		stats.failed_deletes = failed_deletes.Get();
+		return stats;
+	}
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "qht.h"
+
+template <class T, class HashPolicy = DefaultHashPolicy<T>> struct TwoChoiceQHTFilter : QHTFilter<T, HashPolicy> {
+	/**
+	 * QHT in which every key has two candidate cells: its QHT cell (Hash1 modulo the number of cells) and a second one
+	 * drawn from other bits of Hash1 (see SecondAddress). Both cells are checked, their cache lines being prefetched
+	 * together, and an unseen fingerprint goes to the cell with more empty buckets, the first one on a tie.
+	 * A fingerprint is only evicted when both cells are full, from a random bucket of the two.
+	 *
+	 * Load is spread over the cells, so that hot cells evict far less at the same memory: fewer false negatives.
+	 * In exchange, a key is compared with the fingerprints of two cells, which about doubles the false positives
+	 * (one more fingerprint bit brings them back) and the probe time.
+	 * Merge, Diff, Snapshot and Occupancy are those of QHTFilter: a fingerprint stays in the cell it is in.
+	 */
+
+public:
+	TwoChoiceQHTFilter(const uint64_t memory_size, const size_t n_n_buckets, const size_t n_fingerprint_size);
+	bool Lookup(const T& e) { return LookupKey(e); }
+	bool Insert(const T& e) { return InsertKey(e); }
+	bool Stream(const T& e) { return StreamKey(e); }
+	bool Delete(const T& e) { return DeleteKey(e); }
+
+	// Same operations on the bytes of a key (see KeyBytes), its hashes (see Prehash) or its parts (see PrehashParts)
+	bool Lookup(const std::string_view bytes) { return LookupKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Insert(const std::string_view bytes) { return InsertKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Stream(const std::string_view bytes) { return StreamKey(KeyBytes{bytes.data(), bytes.size()}); }
+	bool Delete(const std::string_view bytes) { return DeleteKey(KeyBytes{bytes.data(), bytes.size()}); }
+	template <class C, IfCString<C> = 0> bool Lookup(const C* bytes) { return Lookup(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Insert(const C* bytes) { return Insert(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Stream(const C* bytes) { return Stream(std::string_view(bytes)); }
+	template <class C, IfCString<C> = 0> bool Delete(const C* bytes) { return Delete(std::string_view(bytes)); }
+	bool Lookup(const void* data, const size_t size) { return LookupKey(KeyBytes{data, size}); }
+	bool Insert(const void* data, const size_t size) { return InsertKey(KeyBytes{data, size}); }
+	bool Stream(const void* data, const size_t size) { return StreamKey(KeyBytes{data, size}); }
+	bool Delete(const void* data, const size_t size) { return DeleteKey(KeyBytes{data, size}); }
+	bool LookupHandle(const KeyHandle& handle) { return LookupKey(handle); }
+	bool InsertHandle(const KeyHandle& handle) { return InsertKey(handle); }
+	bool StreamHandle(const KeyHandle& handle) { return StreamKey(handle); }
+	bool DeleteHandle(const KeyHandle& handle) { return DeleteKey(handle); }
+	bool LookupParts(const std::initializer_list<KeyBytes> parts) { return LookupKey(this->PrehashParts(parts)); }
+	bool StreamParts(const std::initializer_list<KeyBytes> parts) { return StreamKey(this->PrehashParts(parts)); }
+	template <class... Fields> bool LookupFields(const Fields&... fields) { return LookupKey(this->PrehashFields(fields...)); }
+	template <class... Fields> bool StreamFields(const Fields&... fields) { return StreamKey(this->PrehashFields(fields...)); }
+#if QHT_IOVEC
+	bool LookupParts(const iovec* ranges, const size_t count) { return LookupKey(this->PrehashParts(ranges, count)); }
+	bool StreamParts(const iovec* ranges, const size_t count) { return StreamKey(this->PrehashParts(ranges, count)); }
+#endif
+
+	void LookupBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { PrefetchCells(handle); },
+			[this](const KeyHandle& handle) { return LookupKey(handle); });
+	}
+	void StreamBatch(const T* keys, const size_t n, bool* results) {
+		this->ForEachInBatch(keys, n, results, [this](const KeyHandle& handle) { PrefetchCells(handle); },
+			[this](const KeyHandle& handle) { return StreamKey(handle); });
+	}
+
+protected:
+	size_t SecondAddress(const HashValue hash1) const;
+	void PrefetchCells(const KeyHandle& handle) const;
+	bool FindInCell(const uint64_t address, const uint64_t fingerprint, size_t& empty_buckets) const;
+	typename QHTFilter<T, HashPolicy>::Insertion InsertInCells(const uint64_t address, const uint64_t second_address, const uint64_t fingerprint);
+	template <class K> bool LookupKey(const K& e);
+	template <class K> bool InsertKey(const K& e);
+	template <class K> bool StreamKey(const K& e);
+	template <class K> bool DeleteKey(const K& e);
+};
+
+template <class T, class HashPolicy> TwoChoiceQHTFilter<T, HashPolicy>::TwoChoiceQHTFilter(
+	const uint64_t memory_size,
+	const size_t n_n_buckets,
+	const size_t n_fingerprint_size
+) : QHTFilter<T, HashPolicy>(memory_size, n_n_buckets, n_fingerprint_size) {
+}
+
+template <class T, class HashPolicy> size_t TwoChoiceQHTFilter<T, HashPolicy>::SecondAddress(const HashValue hash1) const {
+	/**
+	 * The second cell of a key: Hash1 multiplied by an odd constant, the 128-bit product folded, modulo the number
+	 * of cells. It does not depend on Hash2, which some policies derive from Hash1 (see FixedWidthHashPolicy).
+	 */
+	return hash_detail::Fold(hash1, hash_detail::kPrime4) % this->n_cells;
+}
+
+template <class T, class HashPolicy> void TwoChoiceQHTFilter<T, HashPolicy>::PrefetchCells(const KeyHandle& handle) const {
+	this->PrefetchCell(handle.hash1 % this->n_cells);
+	this->PrefetchCell(SecondAddress(handle.hash1));
+}
+
+template <class T, class HashPolicy> bool TwoChoiceQHTFilter<T, HashPolicy>::FindInCell(const uint64_t address, const uint64_t fingerprint, size_t& empty_buckets) const {
+	/**
+	 * @param empty_buckets: output, number of empty buckets of the cell (they are the last ones), if the fingerprint is not found
+	 * @returns true if the fingerprint is in the cell
+	 */
+	empty_buckets = 0;
+	for(size_t i = 0; i < this->n_buckets; ++i) {
+		auto current_fingerprint = this->GetFingerprintFromBucket(address, i);
+		if(current_fingerprint == fingerprint) {
+			return true;
+		}
+		empty_buckets += current_fingerprint == 0;
+	}
+	return false;
+}
+
+template <class T, class HashPolicy> typename QHTFilter<T, HashPolicy>::Insertion TwoChoiceQHTFilter<T, HashPolicy>::InsertInCells(
+	const uint64_t address,
+	const uint64_t second_address,
+	const uint64_t fingerprint
+) {
+	/**
+	 * Inserts a fingerprint in the less loaded of its two cells if it is in neither
+	 * @returns kPresent if the fingerprint was already in one of the cells, otherwise where it was inserted
+	 */
+	size_t empty_buckets, second_empty_buckets;
+	if(FindInCell(address, fingerprint, empty_buckets) || FindInCell(second_address, fingerprint, second_empty_buckets)) {
+		QHT_PHASE(kPhaseProbe);
+		return this->kPresent;
+	}
+	QHT_PHASE(kPhaseProbe);
+
+	// Both cells full: a random bucket of the two is evicted
+	if(empty_buckets == 0 && second_empty_buckets == 0) {
+		auto victim = std::uniform_int_distribution<size_t>(0, 2 * this->n_buckets - 1)(this->rng);
+		this->InsertFingerprintInBucket(victim < this->n_buckets ? address : second_address, victim % this->n_buckets, fingerprint);
+		QHT_PHASE(kPhaseWrite);
+		return this->kEviction;
+	}
+
+	// Empty buckets are the last ones of a cell
+	if(second_empty_buckets > empty_buckets) {
+		this->InsertFingerprintInBucket(second_address, this->n_buckets - second_empty_buckets, fingerprint);
+	} else {
+		this->InsertFingerprintInBucket(address, this->n_buckets - empty_buckets, fingerprint);
+	}
+	QHT_PHASE(kPhaseWrite);
+
+	return this->kEmptyBucket;
+}
+
+template <class T, class HashPolicy> template <class K> bool TwoChoiceQHTFilter<T, HashPolicy>::LookupKey(const K& e) {
+	/** @returns true if the fingerprint of e is in one of its two cells */
+	QHT_PHASE_START(kPhaseLookup);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto hash1 = PolicyHash1<HashPolicy>(key);
+	auto address = hash1 % this->n_cells;
+	auto second_address = SecondAddress(hash1);
+	this->PrefetchCell(second_address);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto found = this->InCell(address, fingerprint) || this->InCell(second_address, fingerprint);
+	QHT_PHASE(kPhaseProbe);
+	QHT_PHASE_STOP();
+
+	return found;
+}
+
+template <class T, class HashPolicy> template <class K> bool TwoChoiceQHTFilter<T, HashPolicy>::InsertKey(const K& e) {
+	/**
+	 * Inserts element e in the filter if not already present
+	 * @returns true
+	 */
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto hash1 = PolicyHash1<HashPolicy>(key);
+	auto second_address = SecondAddress(hash1);
+	this->PrefetchCell(second_address);
+	auto fingerprint = this->Fingerprint(key);
+
+	this->CountInsertion(InsertInCells(hash1 % this->n_cells, second_address, fingerprint));
+
+	return true;
+}
+
+template <class T, class HashPolicy> template <class K> bool TwoChoiceQHTFilter<T, HashPolicy>::StreamKey(const K& e) {
+	/**
+	 * Inserts element e in the less loaded of its two cells if it is in neither
+	 * @returns true if the element was already in the filter, false otherwise
+	 */
+	QHT_PHASE_START(kPhaseStream);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto hash1 = PolicyHash1<HashPolicy>(key);
+	auto address = hash1 % this->n_cells;
+	auto second_address = SecondAddress(hash1);
+	this->PrefetchCell(second_address);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto detected = this->CountInsertion(InsertInCells(address, second_address, fingerprint));
+	QHT_PHASE_STOP();
+
+	this->counters.streams.Increment();
+	if(detected) {
+		this->counters.duplicates.Increment();
+	}
+
+	return detected;
+}
+
+template <class T, class HashPolicy> template <class K> bool TwoChoiceQHTFilter<T, HashPolicy>::DeleteKey(const K& e) {
+	/**
+	 * Deletes one copy of the fingerprint of e from its first cell holding it (see QHTFilter::Delete)
+	 * @returns true if the fingerprint was found (and deleted), false otherwise
+	 */
+	QHT_PHASE_START(kPhaseDelete);
+	const auto& key = PolicyKey<HashPolicy>(e);
+	auto hash1 = PolicyHash1<HashPolicy>(key);
+	auto address = hash1 % this->n_cells;
+	auto second_address = SecondAddress(hash1);
+	QHT_PHASE(kPhaseHash1);
+	auto fingerprint = this->Fingerprint(key);
+
+	auto found = this->RemoveFromCell(address, fingerprint) || this->RemoveFromCell(second_address, fingerprint);
+	QHT_PHASE_STOP();
+
+	if(found) {
+		this->counters.deletes.Increment();
+	} else {
+		this->counters.failed_deletes.Increment();
+	}
+
+	return found;
+}